@@ -0,0 +1,192 @@
+// Ahead-of-time recompiler: walks a ROM from its entry points and writes
+// C++ code for every reachable block, calling the same specialized handlers
+// as the interpreter. gbc_aot_library() in CMakeLists.txt builds the output
+// into a shared library, to be loaded with BlockCache::load_precompiled().
+// The executable loading the library must export its symbols (-rdynamic).
+#include "../src/stuff.hpp"
+#include <cstdio>
+#include <deque>
+#include <libgbc/blocks.hpp>
+#include <map>
+
+struct aot_instr_t
+{
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t imm[2];
+};
+
+static std::vector<uint8_t> rom;
+static std::map<uint32_t, std::vector<aot_instr_t>> blocks;
+static std::deque<uint32_t> worklist;
+
+// queue the guest address, as seen from code in the given bank
+static void add_target(const uint32_t bank, const uint16_t addr)
+{
+    if (addr >= 0x4000 && addr < 0x8000 && bank == 0)
+    {
+        // bank 0 can call into any switchable bank, so walk the target in all
+        // of them (a ROM without banking only has bank 1)
+        for (uint32_t b = 1; b < rom.size() / 0x4000; b++) add_target(b, addr);
+        return;
+    }
+    uint32_t phys;
+    if (addr < 0x4000)
+        phys = addr;
+    else if (addr < 0x8000)
+        phys = bank * 0x4000 + (addr - 0x4000);
+    else
+        return; // not ROM
+    if (phys < rom.size() && blocks.count(phys) == 0) worklist.push_back(phys);
+}
+
+// decode the same way as BlockCache::decode(), and find the successors
+static void walk_block(const uint32_t phys)
+{
+    const uint32_t bank = phys / 0x4000;
+    const uint32_t limit = (bank + 1) * 0x4000;
+    const uint16_t base = (bank == 0) ? 0x0 : 0x4000;
+    std::vector<aot_instr_t> code;
+    uint32_t p = phys;
+    bool fallthrough = true;
+    while (code.size() < gbc::BlockCache::MAX_INSTRUCTIONS)
+    {
+        aot_instr_t instr{rom[p], gbc::opcode_length(rom[p]), {0, 0}};
+        if (p + instr.length > limit) break;
+        for (int i = 1; i < instr.length; i++) { instr.imm[i - 1] = rom[p + i]; }
+        code.push_back(instr);
+        p += instr.length;
+
+        const uint8_t op = instr.opcode;
+        const uint16_t next = base + (p - bank * 0x4000);
+        const uint16_t imm16 = instr.imm[0] | instr.imm[1] << 8;
+        if (op == 0xC3 || (op & 0xE7) == 0xC2 || op == 0xCD || (op & 0xE7) == 0xC4)
+            add_target(bank, imm16);
+        else if (op == 0x18 || (op & 0xE7) == 0x20)
+            add_target(bank, next + (int8_t) instr.imm[0]);
+        else if ((op & 0xC7) == 0xC7)
+            add_target(bank, op & 0x38);
+        if (gbc::ends_block(op))
+        {
+            // unconditional jumps and returns don't continue past themselves
+            fallthrough = !(op == 0xC3 || op == 0x18 || op == 0xE9 || op == 0xC9 || op == 0xD9);
+            break;
+        }
+    }
+    if (code.empty()) return;
+    blocks[phys] = std::move(code);
+    if (fallthrough) add_target(bank, base + (p - bank * 0x4000));
+}
+
+// the options gbc-aot was built with, which the program loading the library
+// was built with too
+static const char* const config_defines[] = {
+    "GBC_AOT",
+#ifdef GBC_LAZY_FLAGS
+    "GBC_LAZY_FLAGS",
+#endif
+#ifdef GBC_PRODUCTION
+    "GBC_PRODUCTION",
+#endif
+#ifdef GBC_THREADED_RENDER
+    "GBC_THREADED_RENDER",
+#endif
+#ifdef GBC_JIT
+    "GBC_JIT",
+#endif
+};
+
+static void write_source(FILE* f, const char* romfile)
+{
+    fprintf(f, "// generated by gbc-aot from %s, do not edit\n", romfile);
+    for (const char* define : config_defines)
+    { fprintf(f, "#ifndef %s\n#define %s\n#endif\n", define, define); }
+    fprintf(f, "#include <libgbc/instructions.cpp>\n\n");
+    fprintf(f, "#define STEP(op, imm)                                                          \\\n"
+               "    cpu.set_operands(imm);                                                     \\\n"
+               "    cpu.registers().pc++;                                                      \\\n"
+               "    cpu.hardware_tick();                                                       \\\n"
+               "    instructions[op].handler(cpu, op);                                         \\\n"
+               "    cpu.set_operands(nullptr);\n");
+    fprintf(f, "#define NEXT()                                                                 \\\n"
+               "    if (!cpu.block_continues()) return;\n\n");
+    fprintf(f, "namespace gbc\n{\n");
+    for (const auto& it : blocks)
+    {
+        fprintf(f, "static void block_%06x(CPU& cpu)\n{\n", it.first);
+        std::string imms;
+        for (const auto& instr : it.second)
+        {
+            for (int i = 1; i < instr.length; i++)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "0x%02x, ", instr.imm[i - 1]);
+                imms += buf;
+            }
+        }
+        if (!imms.empty()) fprintf(f, "    static const uint8_t imm[] = {%s};\n", imms.c_str());
+        size_t offset = 0;
+        for (size_t i = 0; i < it.second.size(); i++)
+        {
+            const auto& instr = it.second[i];
+            if (i > 0) fprintf(f, "    NEXT();\n");
+            if (instr.length > 1)
+            {
+                fprintf(f, "    STEP(0x%02x, imm + %zu);\n", instr.opcode, offset);
+                offset += instr.length - 1;
+            }
+            else
+            {
+                fprintf(f, "    STEP(0x%02x, nullptr);\n", instr.opcode);
+            }
+        }
+        fprintf(f, "}\n");
+    }
+    fprintf(f, "} // namespace gbc\n\n");
+
+    fprintf(f, "extern \"C\" const uint64_t gbc_aot_rom_hash = 0x%016lxull;\n",
+            gbc::rom_hash(rom));
+    fprintf(f, "extern \"C\" const uint64_t gbc_aot_config = "
+               "gbc::aot_config(sizeof(gbc::CPU));\n");
+    fprintf(f, "extern \"C\" const gbc::aot_block_t gbc_aot_blocks[] = {\n");
+    for (const auto& it : blocks)
+    { fprintf(f, "    {0x%06x, gbc::block_%06x},\n", it.first, it.first); }
+    fprintf(f, "};\n");
+    fprintf(f, "extern \"C\" const size_t gbc_aot_count = %zu;\n", blocks.size());
+}
+
+int main(int argc, char** args)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s rom.gb output.cpp\n", args[0]);
+        return 1;
+    }
+    rom = load_file(args[1]);
+    if (rom.size() < 0x4000)
+    {
+        fprintf(stderr, "ROM is too small: %zu bytes\n", rom.size());
+        return 1;
+    }
+    // the program entry point, RST and interrupt vectors
+    add_target(0, 0x100);
+    for (uint16_t addr = 0x0; addr <= 0x60; addr += 0x8) add_target(0, addr);
+
+    while (!worklist.empty())
+    {
+        const uint32_t phys = worklist.front();
+        worklist.pop_front();
+        if (blocks.count(phys) == 0) walk_block(phys);
+    }
+
+    FILE* f = fopen(args[2], "w");
+    if (f == nullptr)
+    {
+        fprintf(stderr, "Could not open %s for writing\n", args[2]);
+        return 1;
+    }
+    write_source(f, args[1]);
+    fclose(f);
+    printf("Wrote %zu blocks to %s\n", blocks.size(), args[2]);
+    return 0;
+}
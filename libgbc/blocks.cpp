@@ -0,0 +1,227 @@
+#include "blocks.hpp"
+
+#include "machine.hpp"
+#ifdef GBC_AOT
+#include <dlfcn.h>
+#endif
+
+namespace gbc
+{
+// physical code space: ROM, then Work RAM, then High RAM
+uint32_t BlockCache::ram_base() const noexcept
+{
+    const size_t rom_size = m_machine.memory.mbc().rom().size();
+    return (rom_size + 0xFFF) & ~0xFFF;
+}
+
+bool BlockCache::translate(const uint16_t pc, uint32_t& phys, uint16_t& limit) const noexcept
+{
+    const auto& mbc = m_machine.memory.mbc();
+    switch (pc & 0xF000)
+    {
+    case 0x0000:
+    case 0x1000:
+    case 0x2000:
+    case 0x3000:
+        phys = pc;
+        limit = 0x4000;
+        return mbc.rom().size() >= 0x4000;
+    case 0x4000:
+    case 0x5000:
+    case 0x6000:
+    case 0x7000:
+        phys = mbc.rombank_offset() | (pc - 0x4000);
+        limit = 0x8000;
+        return mbc.rom().size() >= mbc.rombank_offset() + mbc.rombank_size();
+    case 0xC000:
+        phys = ram_base() + pc - 0xC000;
+        limit = 0xD000;
+        return true;
+    case 0xD000:
+        phys = ram_base() + mbc.wrambank_offset() + pc - 0xD000;
+        limit = 0xE000;
+        return true;
+    case 0xF000:
+        phys = ram_base() + 0x8000 + (pc & 0x7F);
+        limit = Memory::InterruptEn;
+        return Memory::is_within(pc, Memory::ZRAM);
+    }
+    return false;
+}
+
+block_t* BlockCache::lookup(const uint16_t pc)
+{
+    this->m_retired.clear();
+    uint32_t phys;
+    uint16_t limit;
+    if (UNLIKELY(!translate(pc, phys, limit))) return nullptr;
+
+    if (UNLIKELY(m_index.empty()))
+    { m_index.resize((ram_base() + RAM_CODE_SIZE + 0xFFF) / 0x1000); }
+    auto& chunk = m_index[phys / 0x1000];
+    if (UNLIKELY(chunk == nullptr)) { chunk = std::make_unique<chunk_t>(); }
+    auto& entry = (*chunk)[phys % 0x1000];
+    if (UNLIKELY(entry == nullptr)) { entry = this->decode(pc, phys, limit); }
+    return entry;
+}
+
+// B, C, D, E, H and L as bits 0-5, like in the opcodes
+static unsigned reg_bits(const int reg) noexcept { return (reg < 6) ? 1u << reg : 0u; }
+static unsigned pair_bits(const int pair) noexcept { return (pair < 3) ? 3u << (pair * 2) : 0u; }
+
+// the registers an idle-safe instruction writes to
+static unsigned written_regs(const decoded_t& instr) noexcept
+{
+    const uint8_t op = instr.opcode;
+    if (op == 0xCB)
+        return ((instr.imm[0] & 0xC0) == 0x40) ? 0u : reg_bits(instr.imm[0] & 0x7);
+    if ((op & 0xCF) == 0x01) return pair_bits(op >> 4);
+    if ((op & 0xC0) == 0x40 || (op & 0xC7) == 0x06 || (op & 0xC6) == 0x04)
+        return reg_bits((op >> 3) & 0x7);
+    return 0; // only A and the flags
+}
+// the registers an instruction addresses memory with
+static unsigned address_regs(const decoded_t& instr) noexcept
+{
+    const uint8_t op = instr.opcode;
+    if (op == 0x0A) return pair_bits(0);
+    if (op == 0x1A) return pair_bits(1);
+    if (op == 0xF2) return reg_bits(1);
+    if ((op & 0xC7) == 0x46 || (op & 0xC7) == 0x86) return pair_bits(2);
+    if (op == 0xCB && (instr.imm[0] & 0x7) == 0x6) return pair_bits(2);
+    return 0;
+}
+
+// a block that branches back to its own start, without writing anything,
+// and reading memory from where the registers at its end point
+static bool is_idle_loop(const block_t& block, const uint16_t end)
+{
+    const auto& last = block.code.back();
+    const uint8_t op = last.opcode;
+    if (op == 0x18 || (op & 0xE7) == 0x20)
+    {
+        // JR
+        if (uint16_t(end + (int8_t) last.imm[0]) != block.pc) return false;
+    }
+    else if (op == 0xC3 || (op & 0xE7) == 0xC2)
+    {
+        // JP
+        if ((last.imm[0] | last.imm[1] << 8) != block.pc) return false;
+    }
+    else
+        return false;
+
+    // the loop is only skipped when the registers are the same at the start
+    // and the end, so reads have to use registers nothing before them changed
+    unsigned written = 0;
+    for (size_t i = 0; i + 1 < block.code.size(); i++)
+    {
+        const auto& instr = block.code[i];
+        if (instr.opcode == 0xCB ? !cb_idle_safe(instr.imm[0]) : !idle_safe(instr.opcode))
+            return false;
+        if (address_regs(instr) & written) return false;
+        written |= written_regs(instr);
+    }
+    return true;
+}
+
+block_t* BlockCache::decode(const uint16_t pc, const uint32_t phys, const uint16_t limit)
+{
+    auto& memory = m_machine.memory;
+    auto block = std::make_unique<block_t>();
+    block->pc = pc;
+    uint16_t addr = pc;
+    while (block->code.size() < MAX_INSTRUCTIONS)
+    {
+        const uint8_t opcode = memory.read8(addr);
+        decoded_t instr{m_machine.cpu.decode(opcode).handler, opcode, opcode_length(opcode),
+                        {0, 0}};
+        // never decode across the end of the memory region
+        if (addr + instr.length > limit) break;
+        for (int i = 1; i < instr.length; i++) { instr.imm[i - 1] = memory.read8(addr + i); }
+
+        block->code.push_back(instr);
+        addr += instr.length;
+        if (ends_block(opcode)) break;
+    }
+    // an instruction straddling two regions is left to the interpreter
+    if (block->code.empty()) return nullptr;
+    block->idle = is_idle_loop(*block, addr);
+
+    const uint32_t base = ram_base();
+    if (phys < base)
+    {
+        block->rom = true;
+#ifdef GBC_AOT
+        auto it = m_precompiled.find(phys);
+        if (it != m_precompiled.end()) block->native = it->second;
+#endif
+        m_rom_blocks.push_back(std::move(block));
+        return m_rom_blocks.back().get();
+    }
+    // remember which RAM bytes are now cached code
+    for (uint32_t offset = phys - base; offset < phys - base + (addr - pc); offset++)
+    { m_ram_code[offset / 64] |= 1ull << (offset % 64); }
+    // writes to those pages have to go through the slow path now
+    if (phys - base < 0x8000) m_machine.memory.remap_wram();
+    m_ram_blocks.push_back(std::move(block));
+    return m_ram_blocks.back().get();
+}
+
+void BlockCache::flush_ram()
+{
+    const uint32_t base = ram_base();
+    for (size_t i = base / 0x1000; i < m_index.size(); i++) { m_index[i] = nullptr; }
+    for (auto& block : m_ram_blocks) { m_retired.push_back(std::move(block)); }
+    this->m_ram_blocks.clear();
+    this->m_ram_code = {};
+    this->m_generation++;
+    m_machine.memory.remap_wram();
+}
+
+#ifdef GBC_AOT
+bool BlockCache::load_precompiled(const std::string& path)
+{
+    void* library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr)
+    {
+        fprintf(stderr, "Precompiled blocks: %s\n", dlerror());
+        return false;
+    }
+    const auto* config = (const uint64_t*) dlsym(library, "gbc_aot_config");
+    if (config == nullptr || *config != aot_config(sizeof(CPU)))
+    {
+        fprintf(stderr, "Precompiled blocks: %s was built with different options\n",
+                path.c_str());
+        dlclose(library);
+        return false;
+    }
+    const auto* hash = (const uint64_t*) dlsym(library, "gbc_aot_rom_hash");
+    const auto* count = (const size_t*) dlsym(library, "gbc_aot_count");
+    const auto* blocks = (const aot_block_t*) dlsym(library, "gbc_aot_blocks");
+    if (hash == nullptr || count == nullptr || blocks == nullptr ||
+        *hash != rom_hash(m_machine.memory.mbc().rom()))
+    {
+        fprintf(stderr, "Precompiled blocks: %s does not match this ROM\n", path.c_str());
+        dlclose(library);
+        return false;
+    }
+    if (m_library != nullptr) dlclose(m_library);
+    this->m_library = library;
+    this->m_precompiled.clear();
+    for (size_t i = 0; i < *count; i++) { m_precompiled[blocks[i].phys] = blocks[i].native; }
+    // blocks decoded so far have to be decoded again to find their native code
+    this->m_index.clear();
+    for (auto& block : m_rom_blocks) { m_retired.push_back(std::move(block)); }
+    this->m_rom_blocks.clear();
+    this->flush_ram();
+    return true;
+}
+
+BlockCache::~BlockCache()
+{
+    this->m_retired.clear();
+    if (m_library != nullptr) dlclose(m_library);
+}
+#endif
+} // namespace gbc
@@ -0,0 +1,164 @@
+#pragma once
+#include "common.hpp"
+#include "instruction.hpp"
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef GBC_AOT
+#include <unordered_map>
+#endif
+
+namespace gbc
+{
+using native_t = void (*)(CPU&);
+
+// blocks compiled ahead-of-time are exported by shared libraries as a
+// table of these, along with the hash of the ROM they were generated from
+struct aot_block_t
+{
+    uint32_t phys; // ROM offset of the first instruction
+    native_t native;
+};
+// the build options that change the layout of the machine, which a library
+// has to be compiled with to be loaded, along with the size of the CPU
+constexpr uint64_t aot_config(const size_t cpu_size) noexcept
+{
+    uint64_t flags = 0;
+#ifdef GBC_AOT
+    flags |= 0x1;
+#endif
+#ifdef GBC_LAZY_FLAGS
+    flags |= 0x2;
+#endif
+#ifdef GBC_PRODUCTION
+    flags |= 0x4;
+#endif
+#ifdef GBC_THREADED_RENDER
+    flags |= 0x8;
+#endif
+#ifdef GBC_JIT
+    flags |= 0x10;
+#endif
+    return (uint64_t(cpu_size) << 8) | flags;
+}
+inline uint64_t rom_hash(const std::vector<uint8_t>& rom) noexcept
+{
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+    for (const uint8_t byte : rom) { hash = (hash ^ byte) * 0x100000001b3ull; }
+    return hash;
+}
+
+// a single pre-decoded instruction
+struct decoded_t
+{
+    handler_t handler;
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t imm[2]; // immediate operands, in fetch order
+};
+
+// control-flow instructions end blocks
+constexpr bool ends_block(const uint8_t op) noexcept
+{
+    return op == 0x10 || op == 0x76                           // STOP, HALT
+           || op == 0x18 || (op & 0xE7) == 0x20               // JR
+           || op == 0xC3 || (op & 0xE7) == 0xC2 || op == 0xE9 // JP
+           || op == 0xCD || (op & 0xE7) == 0xC4               // CALL
+           || op == 0xC9 || (op & 0xE7) == 0xC0 || op == 0xD9 // RET, RETI
+           || (op & 0xC7) == 0xC7;                            // RST
+}
+
+// instructions that only read memory and change registers, which are
+// allowed in idle loops
+constexpr bool idle_safe(const uint8_t op) noexcept
+{
+    return op == 0x00                                                    // NOP
+           || ((op & 0xC0) == 0x40 && (op & 0xF8) != 0x70)               // LD D, D / (HL)
+           || ((op & 0xC7) == 0x06 && op != 0x36)                        // LD D, imm8
+           || (op & 0xCF) == 0x01                                        // LD R, imm16
+           || ((op & 0xC6) == 0x04 && (op & 0xFE) != 0x34)               // INC/DEC D
+           || op == 0x0A || op == 0x1A || op == 0xF0 || op == 0xF2 || op == 0xFA // LD A, (nn)
+           || (op & 0xC0) == 0x80 || (op & 0xC7) == 0xC6                 // ALU A, D / imm8
+           || (op & 0xE7) == 0x07 || op == 0x2F || op == 0x37 || op == 0x3F; // RLCA.., CPL, SCF
+}
+constexpr bool cb_idle_safe(const uint8_t op) noexcept
+{
+    return (op & 0xC0) == 0x40 || (op & 0x7) != 0x6; // BIT, or registers only
+}
+
+// straight-line code ending at the first control-flow instruction
+struct block_t
+{
+    uint16_t pc;
+    bool rom = false;
+    bool idle = false; // jumps back to itself, only reading memory on the way
+    uint32_t hits = 0;
+    native_t native = nullptr;
+    std::vector<decoded_t> code;
+};
+
+// decoded blocks keyed by their physical location: ROM blocks live as long
+// as the machine, while Work RAM and High RAM blocks are dropped whenever
+// one of the bytes they were decoded from is written to
+class BlockCache
+{
+public:
+    static constexpr int MAX_INSTRUCTIONS = 64;
+
+    BlockCache(Machine& mach) : m_machine(mach) {}
+
+    // find or decode the block at PC, or nullptr when it can't be cached
+    block_t* lookup(uint16_t pc);
+    // bumped whenever a running block may have become stale
+    uint32_t generation() const noexcept { return m_generation; }
+
+    void bank_switched() noexcept { this->m_generation++; }
+    // offset is the physical Work RAM offset
+    void wram_written(uint16_t offset) noexcept { this->ram_written(offset); }
+    void hram_written(uint16_t addr) noexcept { this->ram_written(0x8000 + (addr & 0x7F)); }
+    // whether the 256-byte Work RAM page at this offset holds cached code
+    bool wram_page_cached(uint16_t offset) const noexcept;
+    void flush_ram();
+#ifdef GBC_AOT
+    // load blocks compiled ahead-of-time for this ROM, returns false when
+    // the library is missing, was built with other options than this program,
+    // or was generated from a different ROM
+    bool load_precompiled(const std::string& path);
+    ~BlockCache();
+#endif
+
+private:
+    using chunk_t = std::array<block_t*, 4096>;
+    static constexpr uint32_t RAM_CODE_SIZE = 0x8000 + 0x80;
+
+    bool translate(uint16_t pc, uint32_t& phys, uint16_t& limit) const noexcept;
+    block_t* decode(uint16_t pc, uint32_t phys, uint16_t limit);
+    uint32_t ram_base() const noexcept;
+    void ram_written(uint32_t offset) noexcept;
+
+    Machine& m_machine;
+    uint32_t m_generation = 0;
+    std::vector<std::unique_ptr<chunk_t>> m_index;
+    std::vector<std::unique_ptr<block_t>> m_rom_blocks;
+    std::vector<std::unique_ptr<block_t>> m_ram_blocks;
+    // blocks flushed while they could still be running
+    std::vector<std::unique_ptr<block_t>> m_retired;
+    // one bit for each byte of Work RAM and High RAM that is cached code
+    std::array<uint64_t, RAM_CODE_SIZE / 64> m_ram_code = {};
+#ifdef GBC_AOT
+    void* m_library = nullptr;
+    std::unordered_map<uint32_t, native_t> m_precompiled;
+#endif
+};
+
+inline bool BlockCache::wram_page_cached(const uint16_t offset) const noexcept
+{
+    const uint64_t* bits = &m_ram_code[offset / 64];
+    return (bits[0] | bits[1] | bits[2] | bits[3]) != 0;
+}
+inline void BlockCache::ram_written(const uint32_t offset) noexcept
+{
+    if (UNLIKELY(m_ram_code[offset / 64] & (1ull << (offset % 64)))) this->flush_ram();
+}
+} // namespace gbc
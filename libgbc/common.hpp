@@ -15,6 +15,31 @@ class Machine;
 class Memory;
 class IO;
 constexpr bool ENABLE_GBC = true;
+// compile-time debugging policies: production builds compile breakpoints,
+// logging and sanity checks out of the emulator loop
+struct debug_policy
+{
+    static constexpr bool breakpoints = true;
+    static constexpr bool verbose = true;
+    static constexpr bool checks = true;
+};
+struct production_policy
+{
+    static constexpr bool breakpoints = false;
+    static constexpr bool verbose = false;
+    static constexpr bool checks = false;
+};
+#ifdef GBC_PRODUCTION
+using policy_t = production_policy;
+#else
+using policy_t = debug_policy;
+#endif
+// breakpoints and watchpoints that apply to whichever bank is mapped
+static constexpr int ANY_BANK = -1;
+// hardware scheduling: no event in sight, check again after this many ticks
+constexpr uint64_t NO_EVENT_TICKS = 1ull << 32;
+// ...but time never skips ahead by more than a frame at once
+constexpr uint64_t MAX_EVENT_TICKS = 70224 / 4;
 
 inline void setflag(bool expr, uint8_t& flg, uint8_t mask)
 {
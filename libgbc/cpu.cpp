@@ -2,14 +2,17 @@
 
 #include "instructions.cpp"
 #include "machine.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 
 namespace gbc
 {
-CPU::CPU(Machine& mach) noexcept : m_machine(mach), m_memory(mach.memory) {}
+CPU::CPU(Machine& mach) noexcept : m_machine(mach), m_memory(mach.memory), m_blocks(mach) {}
 
 void CPU::reset() noexcept
 {
+    registers().overwrite_flags(); // drop any pending flags
     if (!machine().is_cgb())
     {
         // gameboy DMG initial register values
@@ -29,12 +32,15 @@ void CPU::reset() noexcept
     registers().sp = 0xfffe;
     registers().pc = memory().bootrom_enabled() ? 0x0 : 0x100;
     this->m_state.cycles_total = 0;
+    // simulate the first tick fully, to find the first event
+    this->m_synced = 0;
+    this->m_next_event = 4;
 }
 
 void CPU::simulate()
 {
     // breakpoint handling
-    if (UNLIKELY(this->break_time() || !this->m_breakpoints.empty()))
+    if (policy_t::breakpoints && UNLIKELY(this->break_time() || !this->m_breakpoints.empty()))
     {
         this->break_checks();
         // user can quit during break
@@ -43,9 +49,18 @@ void CPU::simulate()
     // handle interrupts
     this->handle_interrupts();
 
-    if (!this->is_halting() && !this->is_stopping()) { this->execute(); }
+    if (!this->is_halting() && !this->is_stopping())
+    {
+#ifdef GBC_THREADED_CORE
+        this->execute_threaded();
+#else
+        if (!m_decode_cache || !this->execute_block()) this->execute();
+#endif
+    }
     else
     {
+        // nothing can wake us up before the next hardware event
+        if (LIKELY(m_state.intr_pending == 0 && m_state.switch_cycles == 0)) this->skip_to_event();
         // make sure time passes when not executing instructions
         this->hardware_tick();
         // speed switch
@@ -61,8 +76,9 @@ void CPU::execute()
     auto& instr = decode(opcode);
 
     // 2a. print the instruction (when enabled)
-    if (UNLIKELY(machine().verbose_instructions))
+    if (policy_t::verbose && UNLIKELY(machine().verbose_instructions))
     {
+        registers().materialize();
         char prn[128];
         instr.printer(prn, sizeof(prn), *this, opcode);
         printf("%9lu: [pc %04X] opcode %02X: %s\n", gettime(), registers().pc, opcode, prn);
@@ -75,9 +91,10 @@ void CPU::execute()
     // 4. run instruction handler
     instr.handler(*this, opcode);
 
-    if (UNLIKELY(machine().verbose_instructions))
+    if (policy_t::verbose && UNLIKELY(machine().verbose_instructions))
     {
         // print out the resulting flags reg
+        registers().materialize();
         if (m_state.last_flags != registers().flags)
         {
             m_state.last_flags = registers().flags;
@@ -85,6 +102,13 @@ void CPU::execute()
             printf("* Flags changed: [%s]\n", cstr_flags(fbuf, registers().flags));
         }
     }
+    this->verify_pc();
+}
+
+// the executing code can only be in ROM or RAM
+void CPU::verify_pc()
+{
+    if constexpr (!policy_t::checks) return;
     if (UNLIKELY(memory().is_within(registers().pc, Memory::VideoRAM)))
     {
         fprintf(stderr, "ERROR: PC is in the Video RAM area: %04X\n", registers().pc);
@@ -107,12 +131,234 @@ void CPU::execute()
     }
 }
 
+// execute a pre-decoded block, leaving early when simulate() has anything
+// else to do before the next instruction, or when the block became stale
+bool CPU::execute_block()
+{
+    // logging and read watchpoints need the regular interpreter
+    if (policy_t::verbose && UNLIKELY(machine().verbose_instructions)) return false;
+    if (UNLIKELY(memory().has_read_watchpoints())) return false;
+    block_t* block = m_blocks.lookup(registers().pc);
+    if (block == nullptr) return false;
+
+    this->m_block_generation = m_blocks.generation();
+    this->m_block_scanline = machine().gpu.current_scanline();
+    // remember where an idle loop started
+    const bool idle = block->idle && m_idle_skipping;
+    regs_t before;
+    const uint64_t start = gettime();
+    const uint64_t deadline = m_next_event;
+    if (UNLIKELY(idle))
+    {
+        registers().materialize();
+        before = registers();
+    }
+#ifdef GBC_JIT
+    const bool native = m_jit.hot(*block);
+#else
+    const bool native = block->native != nullptr;
+#endif
+    if (native) { block->native(*this); }
+    else
+    {
+        for (const auto& instr : block->code)
+        {
+            this->m_operands = instr.imm;
+            registers().pc++;
+            this->hardware_tick();
+            instr.handler(*this, instr.opcode);
+            this->m_operands = nullptr;
+            if (!this->block_continues()) break;
+        }
+    }
+    if (UNLIKELY(idle)) this->skip_idle_loop(*block, before, start, deadline);
+    this->verify_pc();
+    return true;
+}
+
+// memory that only changes through hardware events, or by the CPU itself
+static bool event_stable(const uint16_t addr) noexcept
+{
+    // cartridge RAM can hold a real-time clock
+    if (addr >= 0xA000 && addr < 0xC000) return false;
+    if (addr < 0xFF00 || addr >= 0xFF80) return true;
+    // the joypad, DIV, TIMA and the sound registers change in between events
+    return addr != IO::REG_P1 && addr != IO::REG_DIV && addr != IO::REG_TIMA &&
+           (addr < IO::SND_START || addr >= IO::SND_END);
+}
+// the memory read by an idle loop instruction, or -1, where the registers it
+// reads through are the same before and after the loop (see is_idle_loop())
+static int idle_read_address(const decoded_t& instr, const regs_t& regs) noexcept
+{
+    const uint8_t op = instr.opcode;
+    if (op == 0x0A) return regs.bc;
+    if (op == 0x1A) return regs.de;
+    if (op == 0xF0) return 0xFF00 | instr.imm[0];
+    if (op == 0xF2) return 0xFF00 | regs.c;
+    if (op == 0xFA) return instr.imm[0] | instr.imm[1] << 8;
+    if ((op & 0xC7) == 0x46 || (op & 0xC7) == 0x86) return regs.hl;
+    if (op == 0xCB && (instr.imm[0] & 0x7) == 0x6) return regs.hl;
+    return -1;
+}
+
+// an idle loop that ends up where it started, with the same registers,
+// will repeat itself exactly until a hardware event changes what it reads
+void CPU::skip_idle_loop(const block_t& block, const regs_t& before, const uint64_t start,
+                         const uint64_t deadline)
+{
+    // the caller gets to see every event
+    if (m_next_event != deadline) return;
+    auto& regs = registers();
+    regs.materialize();
+    if (regs.pc != block.pc || regs.af != before.af || regs.bc != before.bc ||
+        regs.de != before.de || regs.hl != before.hl || regs.sp != before.sp)
+        return;
+    // something else has to happen before the next iteration
+    if (!this->keep_running(m_block_scanline)) return;
+    if (policy_t::breakpoints &&
+        UNLIKELY(m_break_steps_cnt != 0 || !m_breakpoints.empty() || machine().break_on_io))
+        return;
+    for (const auto& instr : block.code)
+    {
+        const int addr = idle_read_address(instr, regs);
+        if (addr >= 0 && !event_stable(addr)) return;
+    }
+    // skip the iterations that end before the next event
+    const uint64_t now = gettime();
+    const uint64_t cycles = now - start;
+    if (m_next_event <= now + cycles) return;
+    this->m_state.cycles_total += (m_next_event - 1 - now) / cycles * cycles;
+}
+
+bool CPU::block_continues() const noexcept
+{
+    if (UNLIKELY(m_blocks.generation() != m_block_generation)) return false;
+    return this->keep_running(m_block_scanline);
+}
+
+// we can keep executing instructions as long as simulate() would do nothing
+// but execute the next instruction, and the scanline is unchanged
+bool CPU::keep_running(const int scanline) const noexcept
+{
+    if (policy_t::breakpoints && UNLIKELY(m_break || m_break_steps_cnt != 0)) return false;
+    if (policy_t::breakpoints &&
+        UNLIKELY(!m_breakpoints.empty() && breakpoint_at(m_state.registers.pc)))
+        return false;
+    if (UNLIKELY(m_state.intr_pending != 0 || m_state.asleep || m_state.stopped)) return false;
+    if (UNLIKELY((m_state.ime || m_state.haltbug) && m_machine.io.interrupt_mask() != 0))
+        return false;
+    return m_machine.gpu.current_scanline() == scanline && m_machine.is_running();
+}
+
+#ifdef GBC_THREADED_CORE
+// all 256 opcodes, for building the threaded dispatch table
+#define OPCODE_ROW(X, hi)                                                                          \
+    X(0x##hi##0) X(0x##hi##1) X(0x##hi##2) X(0x##hi##3) X(0x##hi##4) X(0x##hi##5) X(0x##hi##6)    \
+    X(0x##hi##7) X(0x##hi##8) X(0x##hi##9) X(0x##hi##A) X(0x##hi##B) X(0x##hi##C) X(0x##hi##D)    \
+    X(0x##hi##E) X(0x##hi##F)
+#define OPCODES(X)                                                                                 \
+    OPCODE_ROW(X, 0) OPCODE_ROW(X, 1) OPCODE_ROW(X, 2) OPCODE_ROW(X, 3) OPCODE_ROW(X, 4)           \
+    OPCODE_ROW(X, 5) OPCODE_ROW(X, 6) OPCODE_ROW(X, 7) OPCODE_ROW(X, 8) OPCODE_ROW(X, 9)           \
+    OPCODE_ROW(X, A) OPCODE_ROW(X, B) OPCODE_ROW(X, C) OPCODE_ROW(X, D) OPCODE_ROW(X, E)           \
+    OPCODE_ROW(X, F)
+
+// threaded-code interpreter: each opcode body is its own specialized handler
+// followed by its own dispatch to the next opcode, and we only leave the loop
+// when an interrupt can happen, a break is armed or the scanline changes
+void CPU::execute_threaded()
+{
+    // verbose instruction logging needs the regular interpreter
+    if (policy_t::verbose && UNLIKELY(machine().verbose_instructions))
+    {
+        this->execute();
+        return;
+    }
+#define OPCODE_LABEL(op) &&opcode_##op,
+    static const void* const dispatch[256] = {OPCODES(OPCODE_LABEL)};
+#undef OPCODE_LABEL
+    const int scanline = machine().gpu.current_scanline();
+    uint8_t opcode;
+
+#define DISPATCH()                                                                                 \
+    opcode = this->peekop8(0);                                                                     \
+    registers().pc++;                                                                              \
+    this->hardware_tick();                                                                         \
+    goto* dispatch[opcode];
+#define OPCODE_BODY(op)                                                                            \
+    opcode_##op:                                                                                   \
+    {                                                                                              \
+        constexpr handler_t handler = instructions[op].handler;                                    \
+        handler(*this, op);                                                                        \
+        if (LIKELY(this->keep_running(scanline))) { DISPATCH(); }                                  \
+        return;                                                                                    \
+    }
+
+    DISPATCH();
+    OPCODES(OPCODE_BODY)
+#undef OPCODE_BODY
+#undef DISPATCH
+}
+#undef OPCODES
+#undef OPCODE_ROW
+#endif
+
 void CPU::hardware_tick()
 {
     this->incr_cycles(4);
-    machine().gpu.simulate();
-    machine().io.simulate();
-    machine().apu.simulate();
+    if (UNLIKELY(m_state.cycles_total >= m_next_event)) this->sync_hardware();
+}
+
+void CPU::sync_hardware()
+{
+    // I/O accessed from within an event is already up to date
+    if (UNLIKELY(m_syncing)) return;
+    this->m_syncing = true;
+    const uint64_t now = m_state.cycles_total;
+    while (m_synced < now)
+    {
+        if (m_next_event > now)
+        {
+            // nothing happens before now
+            this->advance_hardware((now - m_synced) / 4);
+            this->m_synced = now;
+            break;
+        }
+        // skip ahead to the event, and simulate that tick fully
+        this->advance_hardware((m_next_event - m_synced) / 4 - 1);
+        this->m_synced = m_next_event;
+        machine().gpu.simulate();
+        machine().io.simulate();
+        machine().apu.simulate();
+        this->m_syncing = false;
+        this->reschedule();
+        this->m_syncing = true;
+    }
+    this->m_syncing = false;
+}
+
+void CPU::reschedule()
+{
+    // the event in progress reschedules when it is done
+    if (UNLIKELY(m_syncing)) return;
+    const uint64_t ticks = std::min(
+        {machine().gpu.ticks_to_event(), machine().io.ticks_to_event(), MAX_EVENT_TICKS});
+    this->m_next_event = m_synced + 4 * ticks;
+}
+
+void CPU::skip_to_event()
+{
+    // single-stepping and breakpoints see every tick
+    if (policy_t::breakpoints && UNLIKELY(m_break_steps_cnt != 0 || !m_breakpoints.empty()))
+        return;
+    // leave the event tick itself to hardware_tick()
+    if (m_next_event > m_state.cycles_total + 4) this->m_state.cycles_total = m_next_event - 4;
+}
+
+void CPU::advance_hardware(const uint64_t ticks)
+{
+    if (ticks == 0) return;
+    machine().gpu.advance(ticks);
+    machine().io.advance(ticks);
 }
 
 // it takes 2 instruction-cycles to toggle interrupts
@@ -167,7 +413,7 @@ void CPU::handle_interrupts()
 }
 void CPU::interrupt(interrupt_t& intr)
 {
-    if (UNLIKELY(machine().verbose_interrupts))
+    if (policy_t::verbose && UNLIKELY(machine().verbose_interrupts))
     { printf("%9lu: Executing interrupt %s (%#x)\n", this->gettime(), intr.name, intr.mask); }
     // disable interrupt request
     machine().io.reg(IO::REG_IF) &= ~intr.mask;
@@ -178,344 +424,47 @@ void CPU::interrupt(interrupt_t& intr)
     // push PC and jump to INTR addr
     this->push_and_jump(intr.fixed_address);
     // sometimes we want to break on interrupts
-    if (UNLIKELY(machine().break_on_interrupts && !machine().is_breaking()))
+    if (policy_t::breakpoints &&
+        UNLIKELY(machine().break_on_interrupts && !machine().is_breaking()))
     { machine().break_now(); }
     if (intr.callback) intr.callback(machine(), intr);
 }
 
-instruction_t& CPU::decode(const uint8_t opcode)
+const instruction_t& CPU::decode(const uint8_t opcode) { return instructions[opcode]; }
+
+uint8_t CPU::peekop8(int disp)
 {
-    switch (opcode)
-    {
-    case 0x00: // NOP
-        return instr_NOP;
-    case 0x08: // LD SP, imm16
-        return instr_LD_N_SP;
-    case 0x10: // STOP
-        return instr_STOP;
-    case 0x76: // HALT
-        return instr_HALT;
-    // LD D, imm8
-    case 0x06:
-    case 0x16:
-    case 0x26:
-    case 0x36:
-    case 0x0E:
-    case 0x1E:
-    case 0x2E:
-    case 0x3E:
-        return instr_LD_D_N;
-    // LD B, D
-    case 0x40:
-    case 0x41:
-    case 0x42:
-    case 0x43:
-    case 0x44:
-    case 0x45:
-    case 0x46:
-    case 0x47:
-    // LD C, D
-    case 0x48:
-    case 0x49:
-    case 0x4A:
-    case 0x4B:
-    case 0x4C:
-    case 0x4D:
-    case 0x4E:
-    case 0x4F:
-    // LD D, D
-    case 0x50:
-    case 0x51:
-    case 0x52:
-    case 0x53:
-    case 0x54:
-    case 0x55:
-    case 0x56:
-    case 0x57:
-    // LD E, D
-    case 0x58:
-    case 0x59:
-    case 0x5A:
-    case 0x5B:
-    case 0x5C:
-    case 0x5D:
-    case 0x5E:
-    case 0x5F:
-    // LD H, D
-    case 0x60:
-    case 0x61:
-    case 0x62:
-    case 0x63:
-    case 0x64:
-    case 0x65:
-    case 0x66:
-    case 0x67:
-    // LD L, D
-    case 0x68:
-    case 0x69:
-    case 0x6A:
-    case 0x6B:
-    case 0x6C:
-    case 0x6D:
-    case 0x6E:
-    case 0x6F:
-    // LD (HL), D
-    // NOTE: 0x76: is HALT and *not* LD (HL), (HL)
-    case 0x70:
-    case 0x71:
-    case 0x72:
-    case 0x73:
-    case 0x74:
-    case 0x75:
-    case 0x77:
-    // LD A, D
-    case 0x78:
-    case 0x79:
-    case 0x7A:
-    case 0x7B:
-    case 0x7C:
-    case 0x7D:
-    case 0x7E:
-    case 0x7F:
-        return instr_LD_D_D;
-    // LD A, R
-    case 0x02:
-    case 0x12:
-    case 0x0A:
-    case 0x1A:
-        return instr_LD_R_A_R;
-    case 0xEA: // LD (imm16), A
-    case 0xFA: // LD A, (imm16)
-        return instr_LD_N_A_N;
-    case 0x22: // LDI (HL), A
-    case 0x32: // LDD (HL), A
-    case 0x2A: // LDI A, (HL)
-    case 0x3A: // LDD A, (HL)
-        return instr_LDID_HL_A;
-    case 0xE2: // LD (FF00+C), A
-    case 0xF2: // LD A, (FF00+C)
-    case 0xE0: // LD (FF00+imm8), A
-    case 0xF0: // LD A, (FF00+imm8)
-        return instr_LD_FF00_A;
-    // LD R, imm16
-    case 0x01:
-    case 0x11:
-    case 0x21:
-    case 0x31:
-        return instr_LD_R_N;
-    case 0xE8:
-        return instr_ADD_SP_N;
-    case 0xF8: // LD HL, SP+imm8
-    case 0xF9: // LD SP, HL
-        return instr_LD_HL_SP;
-    // POP R
-    case 0xC1:
-    case 0xD1:
-    case 0xE1:
-    case 0xF1:
-    // PUSH R
-    case 0xC5:
-    case 0xD5:
-    case 0xE5:
-    case 0xF5:
-        return instr_PUSH_POP;
-    // ALU operations
-    // ADD A, D
-    case 0x80:
-    case 0x81:
-    case 0x82:
-    case 0x83:
-    case 0x84:
-    case 0x85:
-    case 0x86:
-    case 0x87:
-        return instr_ALU_A_D;
-    // ADC A, D
-    case 0x88:
-    case 0x89:
-    case 0x8A:
-    case 0x8B:
-    case 0x8C:
-    case 0x8D:
-    case 0x8E:
-    case 0x8F:
-        return instr_ALU_A_D;
-    // SUB A, D
-    case 0x90:
-    case 0x91:
-    case 0x92:
-    case 0x93:
-    case 0x94:
-    case 0x95:
-    case 0x96:
-    case 0x97:
-        return instr_ALU_A_D;
-    // SBC A, D
-    case 0x98:
-    case 0x99:
-    case 0x9A:
-    case 0x9B:
-    case 0x9C:
-    case 0x9D:
-    case 0x9E:
-    case 0x9F:
-        return instr_ALU_A_D;
-    // AND A, D
-    case 0xA0:
-    case 0xA1:
-    case 0xA2:
-    case 0xA3:
-    case 0xA4:
-    case 0xA5:
-    case 0xA6:
-    case 0xA7:
-        return instr_ALU_A_D;
-    // XOR A, D
-    case 0xA8:
-    case 0xA9:
-    case 0xAA:
-    case 0xAB:
-    case 0xAC:
-    case 0xAD:
-    case 0xAE:
-    case 0xAF:
-        return instr_ALU_A_D;
-    // OR  A, D
-    case 0xB0:
-    case 0xB1:
-    case 0xB2:
-    case 0xB3:
-    case 0xB4:
-    case 0xB5:
-    case 0xB6:
-    case 0xB7:
-        return instr_ALU_A_D;
-    // CP A, D
-    case 0xB8:
-    case 0xB9:
-    case 0xBA:
-    case 0xBB:
-    case 0xBC:
-    case 0xBD:
-    case 0xBE:
-    case 0xBF:
-        return instr_ALU_A_D;
-    // ALU OP A, im8
-    case 0xC6:
-    case 0xCE:
-    case 0xD6:
-    case 0xDE:
-    case 0xE6:
-    case 0xEE:
-    case 0xF6:
-    case 0xFE:
-        return instr_ALU_A_N;
-    // INC R, DEC R
-    case 0x03:
-    case 0x0B:
-    case 0x13:
-    case 0x1B:
-    case 0x23:
-    case 0x2B:
-    case 0x33:
-    case 0x3B:
-        return instr_INC_DEC_R;
-    // INC D, DEC D
-    case 0x04:
-    case 0x05:
-    case 0x0C:
-    case 0x0D:
-    case 0x14:
-    case 0x15:
-    case 0x1C:
-    case 0x1D:
-    case 0x24:
-    case 0x25:
-    case 0x2C:
-    case 0x2D:
-    case 0x34:
-    case 0x35:
-    case 0x3C:
-    case 0x3D:
-        return instr_INC_DEC_D;
-    // ADD HL, R
-    case 0x09:
-    case 0x19:
-    case 0x29:
-    case 0x39:
-        return instr_ADD_HL_R;
-    case 0x27: // DA A
-        return instr_DAA;
-    case 0x2F: // CPL A
-        return instr_CPL_A;
-    case 0x37: // SCF
-    case 0x3F: // CCF
-        return instr_SCF_CCF;
-    case 0x07: // RLC A
-    case 0x17: // RL A
-    case 0x0F: // RRC A
-    case 0x1F: // RR A
-        return instr_RLC_RRC;
-    case 0xC3: // JP imm16
-    case 0xC2: // JP nz, imm16
-    case 0xCA: // JP z, imm16
-    case 0xD2: // JP nc, imm16
-    case 0xDA: // JP c, imm16
-        return instr_JP;
-    case 0xE9: // JP HL
-        return instr_JP_HL;
-    case 0x18: // JR imm8
-    case 0x20: // JR nz, imm8
-    case 0x28: // JR z, imm8
-    case 0x30: // JR nc, imm8
-    case 0x38: // JR c, imm8
-        return instr_JR_N;
-    case 0xCD: // CALL imm16
-    case 0xC4: // CALL nz, imm16
-    case 0xCC: // CALL z, imm16
-    case 0xD4: // CALL nc, imm16
-    case 0xDC: // CALL c, imm16
-        return instr_CALL;
-    case 0xC9: // RET
-    case 0xC0: // RET nz
-    case 0xC8: // RET z
-    case 0xD0: // RET nc
-    case 0xD8: // RET c
-        return instr_RET;
-    case 0xD9: // RETI
-        return instr_RETI;
-    // RST 0x0, 0x08, 0x10, 0x18
-    case 0xC7:
-    case 0xCF:
-    case 0xD7:
-    case 0xDF:
-    // RST 0x20, 0x028, 0x30, 0x38
-    case 0xE7:
-    case 0xEF:
-    case 0xF7:
-    case 0xFF:
-        return instr_RST;
-    case 0xF3: // DI
-    case 0xFB: // EI
-        return instr_DI_EI;
-    case 0xCB:
-        return instr_CB_EXT;
-    }
-    return instr_MISSING;
+    const uint16_t addr = registers().pc + disp;
+    if (LIKELY(m_fetch != nullptr && (addr >> 8) == m_fetch_page)) return m_fetch[addr & 0xFF];
+    return this->fetch_slow(addr);
+}
+uint16_t CPU::peekop16(int disp) { return peekop8(disp) | peekop8(disp + 1) << 8; }
+uint8_t CPU::fetch_slow(const uint16_t addr)
+{
+    this->m_fetch = memory().fetch_page(addr);
+    this->m_fetch_page = addr >> 8;
+    if (m_fetch != nullptr) return m_fetch[addr & 0xFF];
+    return memory().read8(addr);
 }
-
-uint8_t CPU::peekop8(int disp) { return memory().read8(registers().pc + disp); }
-uint16_t CPU::peekop16(int disp) { return memory().read16(registers().pc + disp); }
 uint8_t CPU::readop8()
 {
-    const uint8_t operand = peekop8(0);
+    const uint8_t operand = (m_operands != nullptr) ? *m_operands++ : peekop8(0);
     registers().pc++;
     hardware_tick();
     return operand;
 }
 uint16_t CPU::readop16()
 {
-    const uint16_t operand = peekop16(0);
+    uint16_t operand;
+    if (m_operands != nullptr)
+    {
+        operand = m_operands[0] | m_operands[1] << 8;
+        this->m_operands += 2;
+    }
+    else
+    {
+        operand = peekop16(0);
+    }
     registers().pc += 2;
     hardware_tick();
     hardware_tick();
@@ -557,11 +506,13 @@ void CPU::incr_cycles(int count)
 
 void CPU::stop()
 {
+    this->sync_hardware();
     this->m_state.stopped = true;
     // preparing a speed switch?
     if (machine().io.reg(IO::REG_KEY1) & 0x1) { this->m_state.switch_cycles = 4; }
     // disable screen etc.
     machine().io.perform_stop();
+    this->reschedule();
 }
 void CPU::handle_speed_switch()
 {
@@ -572,10 +523,12 @@ void CPU::handle_speed_switch()
         {
             // stop the stopping
             this->m_state.stopped = false;
+            this->sync_hardware();
             // change speed
             memory().do_switch_speed();
             // this can turn the LCD back on
             machine().io.deactivate_stop();
+            this->reschedule();
         }
     }
 }
@@ -593,7 +546,7 @@ void CPU::buggy_halt()
 
 void CPU::jump(const uint16_t dest)
 {
-    if (UNLIKELY(machine().verbose_instructions))
+    if (policy_t::verbose && UNLIKELY(machine().verbose_instructions))
     { printf("* Jumped to %04X (from %04X)\n", dest, registers().pc); }
     this->registers().pc = dest;
 }
@@ -609,13 +562,69 @@ void CPU::push_and_jump(uint16_t address)
     this->jump(address);
 }
 
+// the save state format, which is state_t with only the architectural
+// registers, whether or not flags are evaluated lazily
+struct saved_cpu_t
+{
+    uint16_t registers[6]; // AF, BC, DE, HL, SP, PC
+    uint64_t cycles_total;
+    uint8_t last_flags;
+    int8_t intr_pending;
+    bool ime;
+    bool stopped;
+    bool asleep;
+    bool haltbug;
+    uint8_t switch_cycles;
+};
+
 int CPU::restore_state(const std::vector<uint8_t>& data, int off)
 {
-    this->m_state = *(state_t*) &data.at(off);
-    return sizeof(m_state);
+    saved_cpu_t saved;
+    std::memcpy(&saved, &data.at(off), sizeof(saved));
+    this->m_state = state_t{};
+    auto& regs = this->m_state.registers;
+    regs.af = saved.registers[0];
+    regs.bc = saved.registers[1];
+    regs.de = saved.registers[2];
+    regs.hl = saved.registers[3];
+    regs.sp = saved.registers[4];
+    regs.pc = saved.registers[5];
+    this->m_state.cycles_total = saved.cycles_total;
+    this->m_state.last_flags = saved.last_flags;
+    this->m_state.intr_pending = saved.intr_pending;
+    this->m_state.ime = saved.ime;
+    this->m_state.stopped = saved.stopped;
+    this->m_state.asleep = saved.asleep;
+    this->m_state.haltbug = saved.haltbug;
+    this->m_state.switch_cycles = saved.switch_cycles;
+    // the rest of the hardware is restored at the same point in time
+    this->m_synced = m_state.cycles_total;
+    this->m_next_event = m_synced + 4;
+    return sizeof(saved);
 }
 void CPU::serialize_state(std::vector<uint8_t>& res) const
 {
-    res.insert(res.end(), (uint8_t*) &m_state, (uint8_t*) &m_state + sizeof(m_state));
+#ifndef GBC_LAZY_FLAGS
+    static_assert(sizeof(saved_cpu_t) == sizeof(m_state), "same format as before");
+#endif
+    // always store evaluated flags
+    regs_t registers = m_state.registers;
+    registers.materialize();
+    saved_cpu_t saved = {};
+    saved.registers[0] = registers.af;
+    saved.registers[1] = registers.bc;
+    saved.registers[2] = registers.de;
+    saved.registers[3] = registers.hl;
+    saved.registers[4] = registers.sp;
+    saved.registers[5] = registers.pc;
+    saved.cycles_total = m_state.cycles_total;
+    saved.last_flags = m_state.last_flags;
+    saved.intr_pending = m_state.intr_pending;
+    saved.ime = m_state.ime;
+    saved.stopped = m_state.stopped;
+    saved.asleep = m_state.asleep;
+    saved.haltbug = m_state.haltbug;
+    saved.switch_cycles = m_state.switch_cycles;
+    res.insert(res.end(), (uint8_t*) &saved, (uint8_t*) &saved + sizeof(saved));
 }
 } // namespace gbc
@@ -1,4 +1,5 @@
 #pragma once
+#include "blocks.hpp"
 #include "instruction.hpp"
 #include "interrupt.hpp"
 #include "registers.hpp"
@@ -7,6 +8,9 @@
 #include <cassert>
 #include <cstdint>
 #include <map>
+#ifdef GBC_JIT
+#include "jit.hpp"
+#endif
 
 namespace gbc
 {
@@ -35,6 +39,10 @@ public:
     void mtwrite16(uint16_t addr, uint16_t value);
     // perform one hardware tick
     void hardware_tick();
+    // bring the hardware up to date, before accessing it
+    void sync_hardware();
+    // find the next hardware event, after changing the hardware state
+    void reschedule();
     void incr_cycles(int count);
     void push_value(uint16_t addr);
     void push_and_jump(uint16_t addr);
@@ -42,7 +50,7 @@ public:
     void stop();
     void wait(); // wait for interrupts
     void buggy_halt();
-    instruction_t& decode(uint8_t opcode);
+    const instruction_t& decode(uint8_t opcode);
 
     regs_t& registers() noexcept { return m_state.registers; }
     // helpers for reading and writing (HL)
@@ -51,6 +59,18 @@ public:
 
     Memory& memory() noexcept { return m_memory; }
     Machine& machine() noexcept { return m_machine; }
+    BlockCache& blocks() noexcept { return m_blocks; }
+    // used by native blocks: check if the next instruction can run, and
+    // provide immediate operands that readop8() and readop16() will return
+    bool block_continues() const noexcept;
+    void set_operands(const uint8_t* imm) noexcept { this->m_operands = imm; }
+    // the memory map changed, so the code page has to be looked up again
+    void invalidate_fetch() noexcept { this->m_fetch = nullptr; }
+    // run pre-decoded blocks instead of decoding each instruction
+    void decode_cache(bool enabled) noexcept { this->m_decode_cache = enabled; }
+    // fast-forward loops that poll memory until the next hardware event,
+    // can be disabled for ROMs that misbehave (requires the decode cache)
+    void idle_skipping(bool enabled) noexcept { this->m_idle_skipping = enabled; }
 
     void enable_interrupts() noexcept;
     void disable_interrupts() noexcept;
@@ -64,8 +84,9 @@ public:
     void serialize_state(std::vector<uint8_t>&) const;
 
     // debugging
-    void breakpoint(uint16_t address, breakpoint_t func);
-    auto& breakpoints() { return this->m_breakpoints; }
+    // break before executing address, optionally only in one ROM bank
+    void breakpoint(uint16_t address, breakpoint_t func, int bank = ANY_BANK);
+    void clear_breakpoints();
     void default_pausepoint(uint16_t address);
     void break_on_steps(int steps);
     void break_now() { this->m_break = true; }
@@ -77,16 +98,28 @@ public:
 
 private:
     void handle_interrupts();
+    bool execute_block();
+    void skip_idle_loop(const block_t&, const regs_t& before, uint64_t start, uint64_t deadline);
+#ifdef GBC_THREADED_CORE
+    void execute_threaded();
+#endif
+    uint8_t fetch_slow(uint16_t addr);
+    bool keep_running(int scanline) const noexcept;
+    void verify_pc();
+    void skip_to_event();
+    void advance_hardware(uint64_t ticks);
     void handle_speed_switch();
     void execute_interrupts(const uint8_t);
     bool break_time() const;
+    uint32_t breakpoint_location(uint16_t pc) const noexcept;
+    bool breakpoint_at(uint16_t pc) const noexcept;
     void interrupt(interrupt_t&);
 
     Machine& m_machine;
     Memory& m_memory;
     struct state_t
     {
-        regs_t registers;
+        regs_t registers = {};
         uint64_t cycles_total = 0;
         uint8_t last_flags = 0xff;
         int8_t intr_pending = 0;
@@ -96,15 +129,35 @@ private:
         bool haltbug = false;
         uint8_t switch_cycles = 0;
     } m_state;
+    // the hardware has been simulated up to m_synced, and nothing
+    // happens there before the m_next_event deadline
+    uint64_t m_synced = 0;
+    uint64_t m_next_event = 4;
+    bool m_syncing = false;
+    BlockCache m_blocks;
+    // immediate operands of the running pre-decoded instruction
+    const uint8_t* m_operands = nullptr;
+    // direct pointer to the code page PC was last fetched from
+    const uint8_t* m_fetch = nullptr;
+    uint8_t m_fetch_page = 0;
+    uint32_t m_block_generation = 0;
+    int m_block_scanline = 0;
+    bool m_decode_cache = true;
+    bool m_idle_skipping = true;
+#ifdef GBC_JIT
+    JIT m_jit{*this};
+    friend class JIT;
+#endif
     // debugging
     bool m_break = false;
     mutable int16_t m_break_steps = 0;
     mutable int16_t m_break_steps_cnt = 0;
-    std::map<uint16_t, breakpoint_t> m_breakpoints;
+    // one bit per location: the 64k address space, followed by every ROM
+    // bank, so that the fast paths can test PC without a lookup
+    std::vector<uint64_t> m_breakmap;
+    std::map<uint32_t, breakpoint_t> m_breakpoints;
 };
 
-inline void CPU::breakpoint(uint16_t addr, breakpoint_t func) { this->m_breakpoints[addr] = func; }
-
 inline void CPU::default_pausepoint(const uint16_t addr)
 {
     this->breakpoint(addr, breakpoint_t{[](gbc::CPU& cpu, const uint8_t opcode) {
@@ -1,5 +1,6 @@
 #include "cpu.hpp"
 #include "machine.hpp"
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 
@@ -34,9 +35,11 @@ static void print_help()
       s, step [steps=1]     Run [steps] instructions, then break
       v, verbose            Toggle verbose instruction execution
       b, break [addr]       Breakpoint on executing [addr]
-      rb [addr]             Breakpoint on reading from [addr]
-      wb [addr]             Breakpoint on writing to [addr]
-      clear                 Clear all breakpoints
+                            optionally only in one ROM bank: b [addr] (bank)
+      rb [addr] (len=1)     Breakpoint on reading from [addr] (len) bytes
+      wb [addr] (len=1)     Breakpoint on writing to [addr] (len) bytes
+                            rb/wb take an optional (bank) after (len)
+      clear                 Clear all breakpoints and watchpoints
       reset                 Reset the machine
       read [addr] (len=1)   Read from [addr] (len) bytes and print
       write [addr] [value]  Write [value] to memory location [addr]
@@ -91,12 +94,21 @@ static bool execute_commands(CPU& cpu)
             return true;
         }
         unsigned long hex = std::strtoul(params[1].c_str(), 0, 16);
-        cpu.default_pausepoint(hex & 0xFFFF);
+        if (params.size() > 2)
+        {
+            const int bank = std::strtoul(params[2].c_str(), 0, 16);
+            cpu.breakpoint(hex & 0xFFFF, breakpoint_t{CPU::print_and_pause}, bank);
+        }
+        else
+        {
+            cpu.default_pausepoint(hex & 0xFFFF);
+        }
         return true;
     }
     else if (cmd == "clear")
     {
-        cpu.breakpoints().clear();
+        cpu.clear_breakpoints();
+        cpu.memory().clear_watchpoints();
         return true;
     }
     else if (cmd == "rb" || cmd == "wb")
@@ -104,28 +116,32 @@ static bool execute_commands(CPU& cpu)
         const auto mode = (cmd == "rb") ? Memory::READ : Memory::WRITE;
         if (params.size() < 2)
         {
-            printf(">>> Not enough parameters: rb/wb [addr]\n");
+            printf(">>> Not enough parameters: rb/wb [addr] (len=1) (bank)\n");
             return true;
         }
-        uint16_t traploc = std::strtoul(params[1].c_str(), 0, 16) & 0xFFFF;
-        printf("Breaking after any %s %04X (%s)\n", (mode) ? "write to" : "read from", traploc,
-               cpu.memory().explain(traploc).c_str());
-        cpu.memory().breakpoint(mode, [traploc, mode](Memory& mem, uint16_t addr, uint8_t value) {
-            if (addr == traploc)
+        const uint16_t first = std::strtoul(params[1].c_str(), 0, 16) & 0xFFFF;
+        int length = 1;
+        if (params.size() > 2) length = std::max(1, std::stoi(params[2]));
+        const uint16_t last = std::min(first + length - 1, 0xFFFF);
+        int bank = ANY_BANK;
+        if (params.size() > 3) bank = std::strtoul(params[3].c_str(), 0, 16);
+        printf("Breaking after any %s %04X-%04X (%s)", (mode) ? "write to" : "read from", first,
+               last, cpu.memory().explain(first).c_str());
+        if (bank != ANY_BANK) printf(" in bank %02X", bank);
+        printf("\n");
+        cpu.memory().watch(mode, first, last, [mode](Memory& mem, uint16_t addr, uint8_t value) {
+            if (mode == Memory::READ)
             {
-                if (mode == Memory::READ)
-                {
-                    printf("Breaking after read from %04X (%s) with value %02X\n", addr,
-                           mem.explain(addr).c_str(), mem.read8(addr));
-                }
-                else
-                { // WRITE
-                    printf("Breaking after write to %04X (%s) with value %02X (old: %02X)\n", addr,
-                           mem.explain(addr).c_str(), value, mem.read8(addr));
-                }
-                mem.machine().break_now();
+                printf("Breaking after read from %04X (%s) with value %02X\n", addr,
+                       mem.explain(addr).c_str(), mem.read8(addr));
+            }
+            else
+            { // WRITE
+                printf("Breaking after write to %04X (%s) with value %02X (old: %02X)\n", addr,
+                       mem.explain(addr).c_str(), value, mem.read8(addr));
             }
-        });
+            mem.machine().break_now();
+        }, bank);
         return true;
     }
     // verbose instructions
@@ -244,6 +260,7 @@ static bool execute_commands(CPU& cpu)
 
 void CPU::print_and_pause(CPU& cpu, const uint8_t opcode)
 {
+    cpu.registers().materialize();
     char buffer[512];
     cpu.decode(opcode).printer(buffer, sizeof(buffer), cpu, opcode);
     printf("\n");
@@ -297,16 +314,51 @@ void CPU::break_checks()
         // pause for each instruction
         this->print_and_pause(*this, this->peekop8(0));
     }
-    if (!m_breakpoints.empty())
+    if (!m_breakpoints.empty() && this->breakpoint_at(registers().pc))
+    {
+        auto& bp = m_breakpoints.at(breakpoint_location(registers().pc));
+        if (!bp.condition || bp.condition(*this)) bp.callback(*this, this->peekop8(0));
+    }
+}
+
+void CPU::breakpoint(const uint16_t addr, breakpoint_t func, const int bank)
+{
+    const size_t rom_size = std::max<size_t>(memory().mbc().rom().size(), 0x8000);
+    if (m_breakmap.empty()) m_breakmap.resize((0x10000 + rom_size) / 64);
+    std::vector<uint32_t> locations;
+    if ((addr & 0xC000) == 0x4000)
     {
-        // look for breakpoints
-        auto it = m_breakpoints.find(registers().pc);
-        if (it != m_breakpoints.end())
+        // banked ROM has its own locations in each bank
+        for (uint32_t offset = 0x4000; offset < rom_size; offset += 0x4000)
         {
-            auto& bp = it->second;
-            bp.callback(*this, this->peekop8(0));
+            if (bank == ANY_BANK || offset == uint32_t(bank) * 0x4000)
+                locations.push_back(0x10000 + offset + addr - 0x4000);
         }
     }
+    else
+    {
+        locations.push_back(addr);
+    }
+    for (const uint32_t loc : locations)
+    {
+        this->m_breakmap[loc / 64] |= 1ull << (loc % 64);
+        this->m_breakpoints[loc] = func;
+    }
+}
+void CPU::clear_breakpoints()
+{
+    this->m_breakpoints.clear();
+    this->m_breakmap.clear();
+}
+uint32_t CPU::breakpoint_location(const uint16_t pc) const noexcept
+{
+    if ((pc & 0xC000) == 0x4000) return 0x10000 + m_memory.mbc().rombank_offset() + pc - 0x4000;
+    return pc;
+}
+bool CPU::breakpoint_at(const uint16_t pc) const noexcept
+{
+    const uint32_t loc = this->breakpoint_location(pc);
+    return (m_breakmap[loc / 64] >> (loc % 64)) & 1;
 }
 
 void assert_failed(const int expr, const char* strexpr,
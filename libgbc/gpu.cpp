@@ -3,25 +3,44 @@
 #include "machine.hpp"
 #include "sprite.hpp"
 #include "tiledata.hpp"
+#include <algorithm>
 #include <cassert>
 #include <unistd.h>
 
 namespace gbc
 {
-const int GPU::WHITE_IDX;
 GPU::GPU(Machine& mach) noexcept
     : m_memory(mach.memory)
     , m_io(mach.io)
     , m_reg_lcdc{io().reg(IO::REG_LCDC)}
     , m_reg_stat{io().reg(IO::REG_STAT)}
     , m_reg_ly{io().reg(IO::REG_LY)}
+    , m_video_ram(mach.memory.video_ram_ptr())
+    , m_oam(mach.memory.oam_ram_ptr())
+    , m_state() // zeroed, padding included
 {
+    this->set_cgb_mode(false);
     this->reset();
+#ifdef GBC_THREADED_RENDER
+    this->m_video_ram = m_shadow_vram.data();
+    this->m_oam = m_shadow_oam.data();
+    this->m_thread = std::thread(&GPU::render_loop, this);
+#endif
 }
+#ifdef GBC_THREADED_RENDER
+GPU::~GPU()
+{
+    this->queue({render_cmd_t::QUIT});
+    this->m_thread.join();
+}
+#endif
 
 void GPU::reset() noexcept
 {
     m_pixels.resize(SCREEN_W * SCREEN_H);
+#ifdef GBC_THREADED_RENDER
+    m_presented_pixels.resize(SCREEN_W * SCREEN_H);
+#endif
     this->m_state.video_offset = 0;
     // set_mode((m_reg_ly >= 144) ? 1 : 2);
 }
@@ -68,6 +87,10 @@ void GPU::simulate()
 
         if (UNLIKELY(m_reg_ly == 144))
         {
+            auto& log = m_frame_logs[m_current_log];
+            log.frame = m_state.frame_count;
+            log.white = m_state.white_frame;
+            this->m_current_log ^= 1;
             if (this->m_state.white_frame)
             {
                 this->m_state.white_frame = false;
@@ -76,9 +99,12 @@ void GPU::simulate()
                 if (LIKELY(this->m_render))
                 {
                     // clear pixelbuffer with white
-                    std::fill_n(m_pixels.begin(), m_pixels.size(), WHITE_IDX);
+                    this->queue({render_cmd_t::WHITE});
+                    this->m_drawn_frame = m_state.frame_count;
                 }
             }
+            // the frame is drawn while the next one runs, until it's observed
+            this->present();
             // enable MODE 1: V-blank
             set_mode(1);
             // MODE 1: vblank interrupt
@@ -97,6 +123,8 @@ void GPU::simulate()
             set_mode(0);
             // new frame
             m_state.frame_count++;
+            this->queue({render_cmd_t::FRAME});
+            this->m_render_frame = this->frame_wanted(m_state.frame_count);
         }
         // LY == LYC comparison on each line
         this->do_ly_comparison();
@@ -116,9 +144,15 @@ void GPU::simulate()
             // enable MODE 3: Scanline VRAM
             set_mode(3);
 
+            const int y = m_state.current_scanline;
+            const auto& regs = m_frame_logs[m_current_log].lines[y] = this->capture_regs();
             // render a scanline (if rendering enabled)
-            if (LIKELY(!this->m_state.white_frame && this->m_render))
-            { this->render_scanline(m_state.current_scanline); }
+            if (LIKELY(!this->m_state.white_frame && this->m_render && this->m_render_frame))
+            {
+                this->queue({render_cmd_t::LINE, uint8_t(y), 0, 0, regs});
+                if (m_state.current_scanline == SCREEN_H - 1)
+                    this->m_drawn_frame = m_state.frame_count;
+            }
             // TODO: perform HDMA transfers here!
         }
         else if (get_mode() == 3 && period >= oam_cycles() + vram_cycles())
@@ -132,13 +166,66 @@ void GPU::simulate()
     }
 }
 
+uint64_t GPU::ticks_to_event() const noexcept
+{
+    if (!this->lcd_enabled()) return NO_EVENT_TICKS;
+    uint64_t ticks = ticks_until(m_state.period, scanline_cycles());
+    if (get_mode() == 2) return std::min(ticks, ticks_until(m_state.period, oam_cycles()));
+    if (get_mode() == 3)
+        return std::min(ticks, ticks_until(m_state.period, oam_cycles() + vram_cycles()));
+    // scanlines that start quietly are left to advance(), so the next
+    // event can be the next mode 3, or many V-blank lines away
+    int ly = m_state.current_scanline;
+    while (true)
+    {
+        ly = (ly + 1) % 154;
+        if (!this->quiet_scanline(ly)) return ticks;
+        if (!this->is_vblank()) return ticks + ticks_until(0, oam_cycles());
+        ticks += ticks_until(0, scanline_cycles());
+    }
+}
+void GPU::advance(uint64_t ticks) noexcept
+{
+    if (!this->lcd_enabled()) return;
+    // catch up on the scanlines that started in between
+    while (is_hblank() || is_vblank())
+    {
+        const uint64_t until = ticks_until(m_state.period, scanline_cycles());
+        const int ly = (m_state.current_scanline + 1) % 154;
+        if (ticks < until || !this->quiet_scanline(ly)) break;
+        ticks -= until;
+        this->m_state.period = 0;
+        this->m_state.current_scanline = ly;
+        this->m_reg_ly = ly;
+        this->do_ly_comparison();
+        if (!this->is_vblank()) this->set_mode(2);
+    }
+    this->m_state.period += 4 * ticks;
+}
+// the first tick where the period reaches the given cycle
+uint64_t GPU::ticks_until(const uint64_t period, const uint64_t cycle) noexcept
+{
+    return (cycle > period + 4) ? (cycle - period + 3) / 4 : 1;
+}
+// starting scanline ly from H-blank or V-blank only changes LY and STAT,
+// without any interrupts, V-blank or a new frame
+bool GPU::quiet_scanline(const int ly) const noexcept
+{
+    if (ly == 144 || (ly == 1 && is_vblank())) return false;
+    if ((m_reg_stat & 0x40) && ly == m_io.reg(IO::REG_LYC)) return false;
+    return is_vblank() || (m_reg_stat & 0x20) == 0;
+}
+
 bool GPU::is_vblank() const noexcept { return get_mode() == 1; }
 bool GPU::is_hblank() const noexcept { return get_mode() == 0; }
 uint8_t GPU::get_mode() const noexcept { return m_reg_stat & 0x3; }
 void GPU::set_mode(uint8_t mode)
 {
+    const bool was_drawing = get_mode() == 3;
     this->m_reg_stat &= 0xfc;
     this->m_reg_stat |= mode & 0x3;
+    // Video RAM is locked while drawing
+    if (was_drawing != (get_mode() == 3)) m_memory.remap_vram();
 }
 
 void GPU::do_ly_comparison()
@@ -152,19 +239,88 @@ void GPU::do_ly_comparison()
 
 void GPU::render_frame()
 {
+    this->queue({render_cmd_t::FRAME});
     if (!m_state.white_frame && lcd_enabled())
     {
         // render each scanline
-        for (int y = 0; y < SCREEN_H; y++) { this->render_scanline(y); }
+        const auto regs = this->capture_regs();
+        for (int y = 0; y < SCREEN_H; y++)
+        { this->queue({render_cmd_t::LINE, uint8_t(y), 0, 0, regs}); }
     }
     else
     {
         // clear pixelbuffer with white
-        std::fill_n(m_pixels.begin(), m_pixels.size(), WHITE_IDX);
+        this->queue({render_cmd_t::WHITE});
+    }
+    this->present();
+    this->drain();
+}
+const std::vector<uint16_t>& GPU::reconstruct_last_frame()
+{
+    const auto& log = m_frame_logs[m_current_log ^ 1];
+    // nothing has been logged since the machine started or was restored
+    if (log.frame == UINT64_MAX)
+    {
+        this->render_frame();
+        return this->pixels();
+    }
+    this->queue({render_cmd_t::FRAME});
+    if (!log.white)
+    {
+        for (int y = 0; y < SCREEN_H; y++)
+        { this->queue({render_cmd_t::LINE, uint8_t(y), 0, 0, log.lines[y]}); }
+    }
+    else
+    {
+        this->queue({render_cmd_t::WHITE});
+    }
+    this->present();
+    this->drain();
+    this->m_drawn_frame = log.frame;
+    return this->pixels();
+}
+
+void GPU::set_frameskip(const frameskip_t mode, const int interval)
+{
+    GBC_ASSERT(interval > 0);
+    this->m_frameskip = mode;
+    this->m_frame_interval = interval;
+    this->m_render_frame = this->frame_wanted(m_state.frame_count);
+}
+void GPU::request_frame(const uint64_t frame)
+{
+    this->m_requested.insert(frame);
+    if (frame == m_state.frame_count) this->m_render_frame = this->frame_wanted(frame);
+}
+bool GPU::frame_wanted(const uint64_t frame)
+{
+    switch (m_frameskip)
+    {
+    case RENDER_ALL:
+        return true;
+    case RENDER_NTH:
+        return frame % m_frame_interval == 0;
+    case RENDER_REQUESTED:
+        // forget requests for frames that have already passed
+        while (!m_requested.empty() && *m_requested.begin() < frame)
+        { m_requested.erase(m_requested.begin()); }
+        return m_requested.count(frame) != 0;
+    case RENDER_ON_DEMAND:
+        return false;
+    }
+    return true;
+}
+const std::vector<uint16_t>& GPU::observe()
+{
+    if (m_drawn_frame != m_state.frame_count)
+    {
+        this->render_frame();
+        this->m_drawn_frame = m_state.frame_count;
     }
+    return this->pixels();
 }
 
-void GPU::render_scanline(int scan_y)
+void GPU::render_scanline_reference(int scan_y)
 {
     const uint8_t scroll_y = memory().read8(IO::REG_SCY);
     const uint8_t scroll_x = memory().read8(IO::REG_SCX);
@@ -184,6 +340,7 @@ void GPU::render_scanline(int scan_y)
 
     // tile configuration
     tileconf_t tileconf = this->tile_config();
+    std::array<uint16_t, SCREEN_W> line;
 
     // render whole scanline
     for (int scan_x = 0; scan_x < SCREEN_W; scan_x++)
@@ -222,8 +379,10 @@ void GPU::render_scanline(int scan_y)
                 }
             }
         } // BG priority
-        m_pixels.at(scan_y * SCREEN_W + scan_x) = color;
+        line[scan_x] = color;
     } // x
+    this->commit_scanline(scan_y, line.data());
+    this->present();
 } // render_to(...)
 
 uint16_t GPU::colorize_tile(const tileconf_t& conf, const uint8_t attr, const uint8_t idx)
@@ -267,19 +426,20 @@ uint16_t GPU::tile_data() const noexcept { return (m_reg_lcdc & 0x10) ? 0x8000 :
 
 TileData GPU::create_tiledata(uint16_t tiles, uint16_t patterns)
 {
+    // the decoded tiles belong to the render thread, when there is one
+    this->drain();
     const bool is_signed = (m_reg_lcdc & 0x10) == 0;
     const auto* vram = memory().video_ram_ptr();
     // printf("Background tiles: 0x%04x  Tile data: 0x%04x\n",
     //        bg_tiles(), tile_data());
     const auto* tile_base = &vram[tiles - 0x8000];
-    const auto* patt_base = &vram[patterns - 0x8000];
     const uint8_t* attr_base = nullptr;
     if (machine().is_cgb())
     {
         // attributes are always in VRAM bank 1 (which is off=0x2000)
         attr_base = &vram[tiles - 0x8000 + 0x2000];
     }
-    return TileData{tile_base, patt_base, attr_base, is_signed};
+    return TileData{m_tiles, vram, tile_base, (patterns - 0x8000) / 16, attr_base, is_signed};
 }
 tileconf_t GPU::tile_config()
 {
@@ -292,6 +452,7 @@ sprite_config_t GPU::sprite_config()
 {
     sprite_config_t config;
     config.patterns = memory().video_ram_ptr();
+    config.tiles = &m_tiles;
     config.palette[0] = memory().read8(IO::REG_OBP0);
     config.palette[1] = memory().read8(IO::REG_OBP1);
     config.scan_x = 0;
@@ -319,6 +480,23 @@ std::vector<const Sprite*> GPU::find_sprites(const sprite_config_t& config) cons
     }
     return results;
 }
+void GPU::scan_sprites(const Sprite* oam, const sprite_config_t& config)
+{
+    for (auto& line : m_sprite_lines) line.count = 0;
+    // same order and limit as find_sprites(), for every scanline at once
+    for (const Sprite* sprite = oam + 39; sprite >= oam; sprite--)
+    {
+        if (sprite->hidden()) continue;
+        const int first = std::max(sprite->start_y(), 0);
+        const int last = std::min(sprite->start_y() + config.height, SCREEN_H);
+        for (int y = first; y < last; y++)
+        {
+            auto& line = m_sprite_lines[y];
+            if (line.count < 10) line.sprites[line.count++] = sprite;
+        }
+    }
+    this->m_sprite_height = config.height;
+}
 const Sprite* GPU::sprites_begin() const noexcept { return &((Sprite*) memory().oam_ram_ptr())[0]; }
 const Sprite* GPU::sprites_end() const noexcept { return &((Sprite*) memory().oam_ram_ptr())[40]; }
 
@@ -364,6 +542,7 @@ void GPU::set_video_bank(const uint8_t bank)
 {
     assert(bank < 2);
     this->m_state.video_offset = bank * 0x2000;
+    m_memory.remap_vram();
 }
 void GPU::lcd_power_changed(const bool online)
 {
@@ -391,6 +570,7 @@ void GPU::lcd_power_changed(const bool online)
 void GPU::setpal(uint16_t index, uint8_t value)
 {
     this->getpal(index) = value;
+    this->update_color(index / 2);
     // sprite palette index 0 is unused
     if (index >= 64 && (index & 7) < 2) return;
     //
@@ -403,12 +583,66 @@ void GPU::setpal(uint16_t index, uint8_t value)
     }
 } // setpal(...)
 
-void GPU::set_dmg_variant(dmg_variant_t variant) { this->m_variant = variant; }
+void GPU::set_dmg_variant(dmg_variant_t variant)
+{
+    this->m_variant = variant;
+    this->update_colors();
+}
+
+void GPU::set_output(void* buffer, const size_t stride, const pixel_format_t format)
+{
+    this->drain();
+    this->m_output.buffer = (uint8_t*) buffer;
+    this->m_output.stride = stride;
+    this->m_output.format = format;
+    this->update_colors();
+    this->m_colors_gen++;
+}
+uint32_t GPU::rgb_color(const uint8_t idx) const noexcept
+{
+    // the screen is white while it's off
+    if (idx == WHITE_IDX) return 0xFFFFFF;
+    return m_memory.machine().is_cgb() ? expand_cgb_color(idx) : expand_dmg_color(idx & 0x3);
+}
+void GPU::update_color(const uint8_t idx)
+{
+    this->queue({render_cmd_t::COLOR, 0, idx, this->rgb_color(idx)});
+}
+void GPU::update_colors()
+{
+    this->drain();
+    for (int idx = 0; idx < NUM_PALETTES; idx++) this->store_color(idx, rgb_color(idx));
+}
+void GPU::store_color(const uint8_t idx, const uint32_t rgb) noexcept
+{
+    const uint32_t r = rgb & 0xFF;
+    const uint32_t g = (rgb >> 8) & 0xFF;
+    const uint32_t b = (rgb >> 16) & 0xFF;
+    const uint32_t old = m_colors[idx];
+    switch (m_output.format)
+    {
+    case INDEX8:
+        this->m_colors[idx] = idx;
+        break;
+    case RGB565:
+        this->m_colors[idx] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        break;
+    case XRGB8888:
+        this->m_colors[idx] = (r << 16) | (g << 8) | b;
+        break;
+    }
+    // lines drawn with the old color are different now
+    if (m_colors[idx] != old) this->m_colors_gen++;
+}
 
 // serialization
 int GPU::restore_state(const std::vector<uint8_t>& data, int off)
 {
     this->m_state = *(state_t*) &data.at(off);
+    this->update_colors();
+    this->m_render_frame = this->frame_wanted(m_state.frame_count);
+    this->m_drawn_frame = UINT64_MAX;
+    for (auto& log : m_frame_logs) log.frame = UINT64_MAX;
     return sizeof(m_state);
 }
 void GPU::serialize_state(std::vector<uint8_t>& res) const
@@ -2,8 +2,17 @@
 #include "common.hpp"
 #include "sprite.hpp"
 #include "tiledata.hpp"
+#include <array>
+#include <bitset>
 #include <cstdint>
+#include <set>
 #include <vector>
+#ifdef GBC_THREADED_RENDER
+#include "ring.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 
 namespace gbc
 {
@@ -13,20 +22,54 @@ enum dmg_variant_t
     DARKER_GREEN,
     GRAYSCALE
 };
+enum pixel_format_t
+{
+    INDEX8 = 0, // palette indices, like pixels()
+    RGB565,
+    XRGB8888
+};
+enum frameskip_t
+{
+    RENDER_ALL = 0,
+    RENDER_NTH,       // frames where frame_count() is a multiple of the interval
+    RENDER_REQUESTED, // frames asked for with request_frame()
+    RENDER_ON_DEMAND  // none, leaving it to observe()
+};
 class GPU
 {
 public:
-    static const int SCREEN_W = 160;
-    static const int SCREEN_H = 144;
-    static const int NUM_PALETTES = 64;
+    static constexpr int SCREEN_W = 160;
+    static constexpr int SCREEN_H = 144;
+    static constexpr int NUM_PALETTES = 64;
     // this palette idx is used when the screen is off
-    static const int WHITE_IDX = 32;
+    static constexpr int WHITE_IDX = 32;
+#ifdef GBC_THREADED_RENDER
+    static constexpr bool THREADED_RENDER = true;
+#else
+    static constexpr bool THREADED_RENDER = false;
+#endif
 
     GPU(Machine&) noexcept;
+#ifdef GBC_THREADED_RENDER
+    ~GPU();
+#endif
     void reset() noexcept;
     void simulate();
+    // number of ticks until simulate() does more than counting, and
+    // skipping over ticks before that
+    uint64_t ticks_to_event() const noexcept;
+    void advance(uint64_t ticks) noexcept;
     // the vector is resized to exactly fit the screen
-    const auto& pixels() const noexcept { return m_pixels; }
+    // NOTE: with threaded rendering, this is the last frame that reached
+    // V-blank, or was drawn on request, while the next one is being drawn
+    const std::vector<uint16_t>& pixels() const noexcept;
+    // scanlines that were drawn differently than in the previous frame, in
+    // palette indices or in output colors, so far this frame
+    const std::bitset<SCREEN_H>& dirty_lines() const noexcept;
+    bool frame_unchanged() const noexcept { return dirty_lines().none(); }
+    // with threaded rendering, wait until the frame in pixels() is also in
+    // the output buffer, which pixels() and dirty_lines() do by themselves
+    void wait_for_frame() const noexcept;
     // trap on palette changes
     using palchange_func_t = delegate<void(uint8_t idx, uint16_t clr)>;
     void on_palchange(palchange_func_t func) { m_on_palchange = func; }
@@ -34,13 +77,26 @@ public:
     static std::array<uint32_t, 4> dmg_colors(dmg_variant_t = GRAYSCALE);
     // set GB palette used in RGBA mode
     void set_dmg_variant(dmg_variant_t);
+    // also write each scanline into buffer, stride bytes apart, converted to
+    // the format with the palettes as they were when the line was drawn
+    void set_output(void* buffer, size_t stride, pixel_format_t = XRGB8888);
     // get the 32-bit RGB colors (with alpha=0)
     uint32_t expand_cgb_color(uint8_t idx) const noexcept;
     uint32_t expand_dmg_color(uint8_t idx) const noexcept;
     // enable / disable scanline rendering
     void scanline_rendering(bool en) noexcept { this->m_render = en; }
+    // which frames scanline rendering draws, skipped frames only cost timing
+    void set_frameskip(frameskip_t, int interval = 1);
+    void request_frame(uint64_t frame);
+    // the screen, drawn from Video RAM as it is now, unless this frame was
+    // already drawn scanline by scanline
+    const std::vector<uint16_t>& observe();
     // render whole frame now (NOTE: changes are often made mid-frame!)
     void render_frame();
+    // the last frame that reached V-blank, drawn with the registers each of
+    // its scanlines had, which are logged even when nothing is rendered, and
+    // with Video RAM, OAM and CGB palettes as they are now
+    const std::vector<uint16_t>& reconstruct_last_frame();
 
     bool is_vblank() const noexcept;
     bool is_hblank() const noexcept;
@@ -80,20 +136,57 @@ public:
     // OAM sprite inspection
     const Sprite* sprites_begin() const noexcept;
     const Sprite* sprites_end() const noexcept;
+    // render one scanline into the pixel buffer, or do the same with the
+    // pixel-at-a-time reference renderer, which the fast one has to match
+    void render_scanline(int y);
+    void render_scanline_reference(int y);
+    // choose the DMG or CGB renderer, once the machine type is known
+    void set_cgb_mode(bool cgb);
+    // writes to Video RAM and OAM, and changes made to them some other way,
+    // through video_ram_ptr() or by restoring state
+    void vram_written(uint16_t offset, uint8_t value);
+    void oam_written(uint8_t offset, uint8_t value);
+    void reload_video_memory();
 
 private:
     uint64_t scanline_cycles() const noexcept;
     uint64_t oam_cycles() const noexcept;
     uint64_t vram_cycles() const noexcept;
     uint64_t hblank_cycles() const noexcept;
-    void render_scanline(int y);
+    static uint64_t ticks_until(uint64_t period, uint64_t cycle) noexcept;
+    bool quiet_scanline(int ly) const noexcept;
     void do_ly_comparison();
     TileData create_tiledata(uint16_t tiles, uint16_t patt);
     tileconf_t tile_config();
     sprite_config_t sprite_config();
     std::vector<const Sprite*> find_sprites(const sprite_config_t&) const;
+    void scan_sprites(const Sprite* oam, const sprite_config_t&);
     uint16_t colorize_tile(const tileconf_t&, uint8_t attr, uint8_t idx);
     uint16_t colorize_sprite(const Sprite*, sprite_config_t&, uint8_t);
+    uint32_t rgb_color(uint8_t idx) const noexcept;
+    void update_color(uint8_t idx);
+    void update_colors();
+    void store_color(uint8_t idx, uint32_t rgb) noexcept;
+    void output_scanline(int y) noexcept;
+    // the registers a scanline is drawn with
+    struct scanline_regs_t
+    {
+        uint8_t lcdc;
+        uint8_t scy;
+        uint8_t scx;
+        uint8_t wy;
+        uint8_t wx;
+        uint8_t bgp;
+        uint8_t obp0;
+        uint8_t obp1;
+    };
+    scanline_regs_t capture_regs() noexcept;
+    template <bool CGB>
+    void render_line(int y, const scanline_regs_t&);
+    void commit_scanline(int y, const uint16_t* colors);
+    void present();
+    void drain();
+    bool frame_wanted(uint64_t frame);
     // addresses
     uint16_t bg_tiles() const noexcept;
     uint16_t window_tiles() const noexcept;
@@ -105,9 +198,93 @@ private:
     uint8_t& m_reg_stat;
     uint8_t& m_reg_ly;
     std::vector<uint16_t> m_pixels;
+    void (GPU::*m_render_line)(int, const scanline_regs_t&) = nullptr;
+    // the Video RAM and OAM the renderer reads, which are copies of the real
+    // ones owned by the render thread, when there is one
+    const uint8_t* m_video_ram;
+    const uint8_t* m_oam;
+    TileCache m_tiles;
+    // the sprites find_sprites() would return for each scanline, scanned for
+    // this sprite height, or 0 when OAM has changed since
+    struct sprite_line_t
+    {
+        int count;
+        std::array<const Sprite*, 10> sprites;
+    };
+    std::array<sprite_line_t, SCREEN_H> m_sprite_lines;
+    int m_sprite_height = 0;
+    // the output buffer, and every palette index converted to its format
+    struct output_t
+    {
+        uint8_t* buffer = nullptr;
+        size_t stride = 0;
+        pixel_format_t format = INDEX8;
+    } m_output;
+    std::array<uint32_t, NUM_PALETTES> m_colors = {};
+    // changes whenever a color in the table does, and the value each line
+    // was last drawn with
+    uint32_t m_colors_gen = 0;
+    std::array<uint32_t, SCREEN_H> m_line_colors = {};
+    std::bitset<SCREEN_H> m_dirty;
     palchange_func_t m_on_palchange = nullptr;
     dmg_variant_t m_variant = LIGHTER_GREEN;
     bool m_render = true;
+    frameskip_t m_frameskip = RENDER_ALL;
+    int m_frame_interval = 1;
+    std::set<uint64_t> m_requested;
+    // whether the current frame is drawn, and the last frame that was
+    bool m_render_frame = true;
+    uint64_t m_drawn_frame = UINT64_MAX;
+    // the registers of every scanline, of the frame being drawn and of the
+    // last complete one
+    struct frame_log_t
+    {
+        std::array<scanline_regs_t, SCREEN_H> lines;
+        uint64_t frame = UINT64_MAX;
+        bool white = false;
+    };
+    std::array<frame_log_t, 2> m_frame_logs;
+    int m_current_log = 0;
+    // everything that changes what the screen looks like, executed right
+    // away, or replayed in the same order by the render thread
+    struct render_cmd_t
+    {
+        enum type_t : uint8_t
+        {
+            LINE,
+            VRAM,
+            OAM,
+            COLOR,
+            FRAME,
+            WHITE,
+            PRESENT,
+            QUIT
+        };
+        type_t type;
+        uint8_t y = 0;
+        uint16_t offset = 0;
+        uint32_t value = 0;
+        scanline_regs_t regs = {};
+    };
+    void queue(const render_cmd_t&);
+    void execute(const render_cmd_t&);
+#ifdef GBC_THREADED_RENDER
+    void render_loop();
+    Ring<render_cmd_t, 4096> m_ring;
+    uint64_t m_queued = 0;
+    std::atomic<uint64_t> m_executed{0};
+    // the frame that was presented last, which is what pixels() returns
+    // while the render thread draws the next one into m_pixels
+    uint64_t m_present_queued = 0;
+    std::vector<uint16_t> m_presented_pixels;
+    std::bitset<SCREEN_H> m_presented_dirty;
+    std::atomic<bool> m_sleeping{false};
+    std::mutex m_wakeup_mutex;
+    std::condition_variable m_wakeup;
+    std::array<uint8_t, 0x4000> m_shadow_vram = {};
+    std::array<uint8_t, 160> m_shadow_oam = {};
+    std::thread m_thread;
+#endif
 
     struct state_t
     {
@@ -121,6 +298,25 @@ private:
     } m_state;
 };
 
+inline const std::vector<uint16_t>& GPU::pixels() const noexcept
+{
+#ifdef GBC_THREADED_RENDER
+    this->wait_for_frame();
+    return m_presented_pixels;
+#else
+    return m_pixels;
+#endif
+}
+inline const std::bitset<GPU::SCREEN_H>& GPU::dirty_lines() const noexcept
+{
+#ifdef GBC_THREADED_RENDER
+    this->wait_for_frame();
+    return m_presented_dirty;
+#else
+    return m_dirty;
+#endif
+}
+
 inline std::array<uint32_t, 4> GPU::dmg_colors(dmg_variant_t variant)
 {
 #define mRGB(r, g, b) (r | (g << 8) | (b << 16))
@@ -0,0 +1,336 @@
+#include "gpu.hpp"
+
+#include "machine.hpp"
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace gbc
+{
+// a scanline with room for one tile on each side, so that whole tile rows
+// and sprites can be drawn without clipping them
+static constexpr int PAD = 8;
+static constexpr int LINE_W = PAD + GPU::SCREEN_W + PAD;
+struct scanline_t
+{
+    // background palette indices, which sprites behind the background use
+    alignas(16) uint8_t bg_idx[LINE_W];
+    // 0xFF where a CGB background tile has priority over everything else
+    alignas(16) uint8_t bg_prio[LINE_W];
+    alignas(16) uint16_t color[LINE_W];
+};
+
+// dst[i] = mask[i] ? dst[i] : lut[idx[i]] for 8 pixels, where lut maps the
+// 2-bit palette indices to colors
+static inline void draw8(uint16_t* dst, const uint8_t* idx, const uint16_t lut[4],
+                         const uint8_t* mask)
+{
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) idx), zero);
+    __m128i color = _mm_set1_epi16(lut[0]);
+    for (int i = 1; i < 4; i++)
+    {
+        const __m128i sel = _mm_cmpeq_epi16(v, _mm_set1_epi16(i));
+        color = _mm_or_si128(_mm_and_si128(sel, _mm_set1_epi16(lut[i])),
+                             _mm_andnot_si128(sel, color));
+    }
+    const __m128i keep = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) mask), zero);
+    const __m128i keep16 = _mm_cmpgt_epi16(keep, zero);
+    const __m128i old = _mm_loadu_si128((const __m128i*) dst);
+    color = _mm_or_si128(_mm_and_si128(keep16, old), _mm_andnot_si128(keep16, color));
+    _mm_storeu_si128((__m128i*) dst, color);
+#else
+    for (int i = 0; i < 8; i++)
+    {
+        if (mask[i] == 0) dst[i] = lut[idx[i]];
+    }
+#endif
+}
+
+// sprite pixels are drawn where they aren't transparent, the background
+// doesn't have priority, and, for sprites behind the background, where the
+// background is color 0
+static inline void draw_sprite8(uint16_t* dst, const uint8_t* idx, const uint16_t lut[4],
+                                const uint8_t* bg_idx, const uint8_t* bg_prio, bool behind)
+{
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) idx), zero);
+    const __m128i bg = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) bg_idx), zero);
+    const __m128i prio = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) bg_prio), zero);
+    // mask of pixels that are drawn
+    __m128i draw = _mm_andnot_si128(_mm_cmpeq_epi16(v, zero), _mm_cmpeq_epi16(prio, zero));
+    if (behind) draw = _mm_and_si128(draw, _mm_cmpeq_epi16(bg, zero));
+    __m128i color = _mm_loadu_si128((const __m128i*) dst);
+    for (int i = 1; i < 4; i++)
+    {
+        const __m128i sel = _mm_and_si128(draw, _mm_cmpeq_epi16(v, _mm_set1_epi16(i)));
+        color = _mm_or_si128(_mm_and_si128(sel, _mm_set1_epi16(lut[i])),
+                             _mm_andnot_si128(sel, color));
+    }
+    _mm_storeu_si128((__m128i*) dst, color);
+#else
+    for (int i = 0; i < 8; i++)
+    {
+        if (idx[i] != 0 && bg_prio[i] == 0 && (!behind || bg_idx[i] == 0)) dst[i] = lut[idx[i]];
+    }
+#endif
+}
+
+void GPU::set_cgb_mode(const bool cgb)
+{
+    this->drain();
+    this->m_render_line = cgb ? &GPU::render_line<true> : &GPU::render_line<false>;
+    this->update_colors();
+}
+void GPU::render_scanline(const int scan_y)
+{
+    this->queue({render_cmd_t::LINE, uint8_t(scan_y), 0, 0, this->capture_regs()});
+    this->present();
+    this->drain();
+}
+GPU::scanline_regs_t GPU::capture_regs() noexcept
+{
+    const auto& io = this->io();
+    return scanline_regs_t{io.reg(IO::REG_LCDC), io.reg(IO::REG_SCY),  io.reg(IO::REG_SCX),
+                           io.reg(IO::REG_WY),   io.reg(IO::REG_WX),   io.reg(IO::REG_BGP),
+                           io.reg(IO::REG_OBP0), io.reg(IO::REG_OBP1)};
+}
+
+// DMG games have no tile attributes, banks or color palettes, and CGB games
+// don't map colors through BGP, OBP0 and OBP1
+template <bool CGB>
+void GPU::render_line(const int scan_y, const scanline_regs_t& regs)
+{
+    const int sy = (scan_y + regs.scy) % 256;
+    // DMG background colors, or CGB colors before adding the palette
+    uint16_t bg_lut[4];
+    for (int i = 0; i < 4; i++) bg_lut[i] = CGB ? i : (regs.bgp >> (i * 2)) & 0x3;
+    const auto tile_lut = [&](const uint8_t attr, uint16_t lut[4]) {
+        for (int i = 0; i < 4; i++) lut[i] = CGB ? bg_lut[i] + 4 * (attr & 0x7) : bg_lut[i];
+    };
+    // tile maps, where the attributes are in the same place in bank 1
+    const auto tiledata = [&](const uint16_t map) {
+        const uint8_t* tiles = &m_video_ram[map - 0x8000];
+        const bool sign = (regs.lcdc & 0x10) == 0;
+        return TileData{m_tiles, m_video_ram, tiles, sign ? 0x80 : 0x0,
+                        CGB ? &tiles[0x2000] : nullptr, sign};
+    };
+    alignas(16) static const uint8_t no_prio[8] = {};
+    scanline_t line = {};
+
+    // background, one tile row at a time, starting left of the screen
+    auto td = tiledata((regs.lcdc & 0x08) ? 0x9C00 : 0x9800);
+    for (int tx = 0, x = PAD - (regs.scx & 7); tx < SCREEN_W / 8 + 1; tx++, x += 8)
+    {
+        const int map_x = ((regs.scx >> 3) + tx) & 31;
+        const int tid = td.tile_id(map_x, sy / 8);
+        const int tattr = CGB ? td.tile_attr(map_x, sy / 8) : 0;
+        const uint8_t* row = td.row(tid, tattr, sy & 7);
+        uint16_t lut[4];
+        tile_lut(tattr, lut);
+        draw8(&line.color[x], row, lut, no_prio);
+        std::memcpy(&line.bg_idx[x], row, 8);
+        if (CGB && (tattr & 0x80)) std::memset(&line.bg_prio[x], 0xFF, 8);
+    }
+
+    // the window covers the background from WX-7 to the right edge
+    const bool window = (regs.lcdc & 0x20) && regs.wx < 166 && regs.wy < 143;
+    if (window && scan_y >= regs.wy)
+    {
+        auto wtd = tiledata((regs.lcdc & 0x40) ? 0x9C00 : 0x9800);
+        const int wpy = scan_y - regs.wy;
+        const int start_x = regs.wx - 7;
+        for (int tx = 0, x = start_x; x < SCREEN_W; tx++, x += 8)
+        {
+            const int wtile = wtd.tile_id(tx, wpy / 8);
+            const int wattr = CGB ? wtd.tile_attr(tx, wpy / 8) : 0;
+            const uint8_t* row = wtd.row(wtile, wattr, wpy & 7);
+            uint16_t lut[4];
+            tile_lut(wattr, lut);
+            draw8(&line.color[PAD + x], row, lut, CGB ? &line.bg_prio[PAD + x] : no_prio);
+        }
+    }
+
+    // sprites, where the first one in OAM ends up on top
+    sprite_config_t sprconf;
+    sprconf.patterns = m_video_ram;
+    sprconf.tiles = &m_tiles;
+    sprconf.palette[0] = regs.obp0;
+    sprconf.palette[1] = regs.obp1;
+    sprconf.scan_x = 0;
+    sprconf.scan_y = scan_y;
+    sprconf.set_height(regs.lcdc & 0x4);
+    sprconf.is_cgb = CGB;
+    if (UNLIKELY(sprconf.height != m_sprite_height))
+    { this->scan_sprites((const Sprite*) m_oam, sprconf); }
+    const auto& sprites = m_sprite_lines[scan_y];
+    for (int n = 0; n < sprites.count; n++)
+    {
+        const Sprite* sprite = sprites.sprites[n];
+        uint16_t lut[4];
+        const uint8_t obp = sprconf.palette[sprite->pal()];
+        for (int i = 0; i < 4; i++)
+        { lut[i] = CGB ? 32 + 4 * sprite->cgb_pal() + i : (obp >> (i * 2)) & 0x3; }
+        const int x = PAD + sprite->start_x();
+        draw_sprite8(&line.color[x], sprite->row<CGB>(sprconf), lut, &line.bg_idx[x],
+                     &line.bg_prio[x], sprite->behind());
+    }
+    this->commit_scanline(scan_y, &line.color[PAD]);
+}
+
+void GPU::commit_scanline(const int y, const uint16_t* colors)
+{
+    uint16_t* dst = &m_pixels.at(y * SCREEN_W);
+    if (std::memcmp(dst, colors, SCREEN_W * sizeof(uint16_t)) != 0 ||
+        m_line_colors[y] != m_colors_gen)
+    {
+        this->m_dirty.set(y);
+        this->m_line_colors[y] = m_colors_gen;
+        std::copy_n(colors, SCREEN_W, dst);
+    }
+    this->output_scanline(y);
+}
+
+void GPU::output_scanline(const int y) noexcept
+{
+    if (m_output.buffer == nullptr) return;
+    const uint16_t* src = &m_pixels[y * SCREEN_W];
+    uint8_t* dst = m_output.buffer + y * m_output.stride;
+    switch (m_output.format)
+    {
+    case INDEX8:
+        for (int x = 0; x < SCREEN_W; x++) dst[x] = src[x];
+        break;
+    case RGB565:
+        for (int x = 0; x < SCREEN_W; x++) ((uint16_t*) dst)[x] = m_colors[src[x]];
+        break;
+    case XRGB8888:
+        for (int x = 0; x < SCREEN_W; x++) ((uint32_t*) dst)[x] = m_colors[src[x]];
+        break;
+    }
+}
+
+void GPU::vram_written(const uint16_t offset, const uint8_t value)
+{
+    this->queue({render_cmd_t::VRAM, 0, offset, value});
+}
+void GPU::oam_written(const uint8_t offset, const uint8_t value)
+{
+    this->queue({render_cmd_t::OAM, 0, offset, value});
+}
+void GPU::reload_video_memory()
+{
+    this->drain();
+#ifdef GBC_THREADED_RENDER
+    std::copy_n(memory().video_ram_ptr(), m_shadow_vram.size(), m_shadow_vram.begin());
+    std::copy_n(memory().oam_ram_ptr(), m_shadow_oam.size(), m_shadow_oam.begin());
+#endif
+    this->m_tiles.invalidate_all();
+    this->m_sprite_height = 0;
+}
+
+void GPU::execute(const render_cmd_t& cmd)
+{
+    switch (cmd.type)
+    {
+    case render_cmd_t::LINE:
+        (this->*m_render_line)(cmd.y, cmd.regs);
+        return;
+    case render_cmd_t::VRAM:
+#ifdef GBC_THREADED_RENDER
+        this->m_shadow_vram[cmd.offset] = cmd.value;
+#endif
+        this->m_tiles.invalidate(cmd.offset);
+        return;
+    case render_cmd_t::OAM:
+#ifdef GBC_THREADED_RENDER
+        this->m_shadow_oam[cmd.offset] = cmd.value;
+#endif
+        // the sprites on each scanline have to be found again
+        this->m_sprite_height = 0;
+        return;
+    case render_cmd_t::COLOR:
+        this->store_color(cmd.offset, cmd.value);
+        return;
+    case render_cmd_t::FRAME:
+        this->m_dirty.reset();
+        return;
+    case render_cmd_t::WHITE:
+    {
+        std::array<uint16_t, SCREEN_W> white;
+        white.fill(WHITE_IDX);
+        for (int y = 0; y < SCREEN_H; y++) this->commit_scanline(y, white.data());
+        return;
+    }
+    case render_cmd_t::PRESENT:
+#ifdef GBC_THREADED_RENDER
+        this->m_presented_pixels = m_pixels;
+        this->m_presented_dirty = m_dirty;
+#endif
+        return;
+    case render_cmd_t::QUIT:
+        return;
+    }
+}
+
+#ifdef GBC_THREADED_RENDER
+void GPU::queue(const render_cmd_t& cmd)
+{
+    while (!m_ring.push(cmd)) { std::this_thread::yield(); }
+    this->m_queued++;
+    if (m_sleeping.load())
+    {
+        std::lock_guard<std::mutex> lock(m_wakeup_mutex);
+        m_wakeup.notify_one();
+    }
+}
+// pixels() and dirty_lines() show what was drawn up to here
+void GPU::present()
+{
+    this->queue({render_cmd_t::PRESENT});
+    this->m_present_queued = m_queued;
+}
+void GPU::wait_for_frame() const noexcept
+{
+    while (m_executed.load(std::memory_order_acquire) < m_present_queued)
+    { std::this_thread::yield(); }
+}
+// wait until the render thread has caught up with the emulator
+void GPU::drain()
+{
+    while (m_executed.load(std::memory_order_acquire) != m_queued) { std::this_thread::yield(); }
+}
+void GPU::render_loop()
+{
+    render_cmd_t cmd;
+    for (uint64_t executed = 1;; executed++)
+    {
+        for (int spins = 0; !m_ring.pop(cmd); spins++)
+        {
+            if (spins < 64)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            // nothing to do, so sleep until there is
+            std::unique_lock<std::mutex> lock(m_wakeup_mutex);
+            this->m_sleeping = true;
+            m_wakeup.wait(lock, [this] { return !m_ring.empty(); });
+            this->m_sleeping = false;
+        }
+        if (cmd.type == render_cmd_t::QUIT) return;
+        this->execute(cmd);
+        this->m_executed.store(executed, std::memory_order_release);
+    }
+}
+#else
+void GPU::queue(const render_cmd_t& cmd) { this->execute(cmd); }
+void GPU::present() {}
+void GPU::wait_for_frame() const noexcept {}
+void GPU::drain() {}
+#endif
+} // namespace gbc
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <string>
 
 namespace gbc
@@ -24,4 +25,17 @@ struct instruction_t
     const handler_t handler;
     const printer_t printer;
 };
+
+// size of each opcode in bytes, including immediate operands
+constexpr uint8_t opcode_length(const uint8_t op) noexcept
+{
+    if (op == 0x08 || (op & 0xCF) == 0x01 || (op & 0xEF) == 0xEA) return 3; // LD imm16
+    if (op == 0xC3 || (op & 0xE7) == 0xC2) return 3;                        // JP
+    if (op == 0xCD || (op & 0xE7) == 0xC4) return 3;                        // CALL
+    if ((op & 0xC7) == 0x06 || (op & 0xC7) == 0xC6) return 2;               // LD/ALU imm8
+    if (op == 0x18 || (op & 0xE7) == 0x20) return 2;                        // JR
+    if (op == 0xE0 || op == 0xF0 || op == 0xE8 || op == 0xF8) return 2;
+    if (op == 0x10 || op == 0xCB) return 2; // STOP, CB prefix
+    return 1;
+}
 } // namespace gbc
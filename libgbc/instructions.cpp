@@ -1,10 +1,15 @@
 // only include this file once!
 #include "machine.hpp"
 #include "printers.hpp"
-#define DEF_INSTR(x)                                                                               \
-    static instruction_t instr_##x { handler_##x, printer_##x }
-#define INSTRUCTION(x) static void handler_##x
+#include <utility>
+// handlers are specialized for each opcode (OP), so that register selection,
+// ALU operation and branch conditions are all resolved at compile-time
+#define INSTRUCTION(x)                                                                             \
+    template <uint8_t OP>                                                                          \
+    static void handler_##x
 #define PRINTER(x) static int printer_##x
+#define INSTR(x)                                                                                   \
+    instruction_t { handler_##x<OP>, printer_##x }
 union imm8_t
 {
     uint8_t u8;
@@ -25,20 +30,17 @@ PRINTER(LD_N_SP)(char* buffer, size_t len, CPU& cpu, const uint8_t)
     return snprintf(buffer, len, "LD (%04X), SP", cpu.peekop16(1));
 }
 
-INSTRUCTION(LD_R_N)(CPU& cpu, const uint8_t opcode)
-{
-    cpu.registers().getreg_sp(opcode) = cpu.readop16();
-}
+INSTRUCTION(LD_R_N)(CPU& cpu, const uint8_t) { cpu.registers().getreg_sp<OP>() = cpu.readop16(); }
 PRINTER(LD_R_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 {
     return snprintf(buffer, len, "LD %s, %04x", cstr_reg(opcode, true), cpu.peekop16(1));
 }
 
-INSTRUCTION(ADD_HL_R)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(ADD_HL_R)(CPU& cpu, const uint8_t)
 {
-    auto& reg = cpu.registers().getreg_sp(opcode);
+    auto& reg = cpu.registers().getreg_sp<OP>();
     auto& hl = cpu.registers().hl;
-    auto& flags = cpu.registers().flags;
+    auto& flags = cpu.registers().get_flags();
     setflag(false, flags, MASK_NEGATIVE);
     setflag(((hl & 0x0fff) + (reg & 0x0fff)) & 0x1000, flags, MASK_HALFCARRY);
     setflag(((hl & 0x0ffff) + (reg & 0x0ffff)) & 0x10000, flags, MASK_CARRY);
@@ -50,12 +52,13 @@ PRINTER(ADD_HL_R)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "ADD HL, %s", cstr_reg(opcode, true));
 }
 
-INSTRUCTION(LD_R_A_R)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_R_A_R)(CPU& cpu, const uint8_t)
 {
-    if (opcode & 0x8) { cpu.registers().accum = cpu.mtread8(cpu.registers().getreg_sp(opcode)); }
+    if constexpr (OP & 0x8)
+    { cpu.registers().accum = cpu.mtread8(cpu.registers().getreg_sp<OP>()); }
     else
     {
-        cpu.mtwrite8(cpu.registers().getreg_sp(opcode), cpu.registers().accum);
+        cpu.mtwrite8(cpu.registers().getreg_sp<OP>(), cpu.registers().accum);
     }
 }
 PRINTER(LD_R_A_R)(char* buffer, size_t len, CPU&, uint8_t opcode)
@@ -64,10 +67,10 @@ PRINTER(LD_R_A_R)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "LD (%s), A", cstr_reg(opcode, true));
 }
 
-INSTRUCTION(INC_DEC_R)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(INC_DEC_R)(CPU& cpu, const uint8_t)
 {
-    auto& reg = cpu.registers().getreg_sp(opcode);
-    if ((opcode & 0x8) == 0) { reg++; }
+    auto& reg = cpu.registers().getreg_sp<OP>();
+    if constexpr ((OP & 0x8) == 0) { reg++; }
     else
     {
         reg--;
@@ -80,36 +83,30 @@ PRINTER(INC_DEC_R)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "DEC %s", cstr_reg(opcode, true));
 }
 
-INSTRUCTION(INC_DEC_D)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(INC_DEC_D)(CPU& cpu, const uint8_t)
 {
-    const uint8_t dst = opcode >> 3;
+    constexpr uint8_t dst = OP >> 3;
     uint8_t value;
-    if (dst != 0x6)
+    if constexpr ((dst & 0x7) != 0x6)
     {
-        if ((opcode & 0x1) == 0) { cpu.registers().getdest(dst)++; }
+        if constexpr ((OP & 0x1) == 0) { cpu.registers().getdest<dst>()++; }
         else
         {
-            cpu.registers().getdest(dst)--;
+            cpu.registers().getdest<dst>()--;
         }
-        value = cpu.registers().getdest(dst);
+        value = cpu.registers().getdest<dst>();
     }
     else
     {
         value = cpu.read_hl();
-        if ((opcode & 0x1) == 0) { value++; }
+        if constexpr ((OP & 0x1) == 0) { value++; }
         else
         {
             value--;
         }
         cpu.write_hl(value);
     }
-    auto& flags = cpu.registers().flags;
-    setflag(opcode & 0x1, flags, MASK_NEGATIVE);
-    setflag(value == 0, flags, MASK_ZERO); // set zero
-    if ((opcode & 0x1) == 0)
-        setflag((value & 0xF) == 0x0, flags, MASK_HALFCARRY);
-    else
-        setflag((value & 0xF) == 0xF, flags, MASK_HALFCARRY);
+    cpu.registers().incdec_flags<OP & 0x1>(value);
 }
 PRINTER(INC_DEC_D)(char* buffer, size_t len, CPU&, uint8_t opcode)
 {
@@ -117,10 +114,10 @@ PRINTER(INC_DEC_D)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "%s %s", mnemonic, cstr_dest(opcode >> 3));
 }
 
-INSTRUCTION(LD_D_N)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_D_N)(CPU& cpu, const uint8_t)
 {
     const uint8_t imm8 = cpu.readop8();
-    if (((opcode >> 3) & 0x7) != 0x6) { cpu.registers().getdest(opcode >> 3) = imm8; }
+    if constexpr (((OP >> 3) & 0x7) != 0x6) { cpu.registers().getdest<(OP >> 3)>() = imm8; }
     else
     {
         cpu.write_hl(imm8);
@@ -134,13 +131,12 @@ PRINTER(LD_D_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
         return snprintf(buffer, len, "LD (HL=%04X), %02X", cpu.registers().hl, cpu.peekop8(1));
 }
 
-INSTRUCTION(RLC_RRC)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(RLC_RRC)(CPU& cpu, const uint8_t)
 {
     auto& accum = cpu.registers().accum;
-    auto& flags = cpu.registers().flags;
-    switch (opcode)
-    {
-    case 0x07:
+    const uint8_t carry = cpu.registers().carry();
+    auto& flags = cpu.registers().overwrite_flags();
+    if constexpr (OP == 0x07)
     {
         // RLCA, rotate A left
         const uint8_t bit7 = accum & 0x80;
@@ -148,8 +144,7 @@ INSTRUCTION(RLC_RRC)(CPU& cpu, const uint8_t opcode)
         flags = 0;
         setflag(bit7, flags, MASK_CARRY); // old bit7 to CF
     }
-    break;
-    case 0x0F:
+    else if constexpr (OP == 0x0F)
     {
         // RRCA, rotate A right
         const uint8_t bit0 = accum & 0x1;
@@ -157,28 +152,23 @@ INSTRUCTION(RLC_RRC)(CPU& cpu, const uint8_t opcode)
         flags = 0;
         setflag(bit0, flags, MASK_CARRY); // old bit0 to CF
     }
-    break;
-    case 0x17:
+    else if constexpr (OP == 0x17)
     {
         // RLA, rotate A left, old CF to bit 0
         const uint8_t bit7 = accum & 0x80;
-        accum = (accum << 1) | ((flags & MASK_CARRY) >> 4);
+        accum = (accum << 1) | carry;
         flags = 0;
         setflag(bit7, flags, MASK_CARRY); // old bit7 to CF
     }
-    break;
-    case 0x1F:
+    else
     {
+        static_assert(OP == 0x1F, "Unknown opcode in RLC/RRC handler");
         // RRA, rotate A right, old CF to bit 7
         const uint8_t bit0 = accum & 0x1;
-        accum = (accum >> 1) | ((flags & MASK_CARRY) << 3);
+        accum = (accum >> 1) | (carry << 7);
         flags = 0;
         setflag(bit0, flags, MASK_CARRY); // old bit0 to CF
     }
-    break;
-    default:
-        GBC_ASSERT(0 && "Unknown opcode in RLC/RRC handler");
-    }
 }
 PRINTER(RLC_RRC)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 {
@@ -186,16 +176,16 @@ PRINTER(RLC_RRC)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
     return snprintf(buffer, len, "%s A (A = %02X)", mnemonic[opcode >> 3], cpu.registers().accum);
 }
 
-INSTRUCTION(LD_D_D)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_D_D)(CPU& cpu, const uint8_t)
 {
-    const bool HL = (opcode & 0x7) == 0x6;
+    constexpr bool HL = (OP & 0x7) == 0x6;
     uint8_t reg;
-    if (!HL)
-        reg = cpu.registers().getdest(opcode);
+    if constexpr (!HL)
+        reg = cpu.registers().getdest<OP>();
     else
         reg = cpu.read_hl();
 
-    if (((opcode >> 3) & 0x7) != 0x6) { cpu.registers().getdest(opcode >> 3) = reg; }
+    if constexpr (((OP >> 3) & 0x7) != 0x6) { cpu.registers().getdest<(OP >> 3)>() = reg; }
     else
     {
         cpu.write_hl(reg);
@@ -206,10 +196,10 @@ PRINTER(LD_D_D)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "LD %s, %s", cstr_dest(opcode >> 3), cstr_dest(opcode >> 0));
 }
 
-INSTRUCTION(LD_N_A_N)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_N_A_N)(CPU& cpu, const uint8_t)
 {
     const uint16_t addr = cpu.readop16();
-    if (opcode == 0xEA)
+    if constexpr (OP == 0xEA)
     {
         // load into (N) from A
         cpu.mtwrite8(addr, cpu.registers().accum);
@@ -230,9 +220,9 @@ PRINTER(LD_N_A_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
         return snprintf(buffer, len, "LD A, (%04X)", cpu.peekop16(1));
 }
 
-INSTRUCTION(LDID_HL_A)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LDID_HL_A)(CPU& cpu, const uint8_t)
 {
-    if ((opcode & 0x8) == 0)
+    if constexpr ((OP & 0x8) == 0)
     {
         // load from A into (HL)
         cpu.write_hl(cpu.registers().accum);
@@ -242,7 +232,7 @@ INSTRUCTION(LDID_HL_A)(CPU& cpu, const uint8_t opcode)
         // load from (HL) into A
         cpu.registers().accum = cpu.read_hl();
     }
-    if ((opcode & 0x10) == 0) { cpu.registers().hl++; }
+    if constexpr ((OP & 0x10) == 0) { cpu.registers().hl++; }
     else
     {
         cpu.registers().hl--;
@@ -260,6 +250,7 @@ PRINTER(LDID_HL_A)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 INSTRUCTION(DAA)(CPU& cpu, const uint8_t)
 {
     auto& regs = cpu.registers();
+    regs.materialize();
     if (regs.flags & MASK_NEGATIVE)
     {
         if (regs.flags & MASK_CARRY) regs.accum -= 0x60;
@@ -282,16 +273,16 @@ PRINTER(DAA)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer,
 INSTRUCTION(CPL_A)(CPU& cpu, const uint8_t)
 {
     cpu.registers().accum = ~cpu.registers().accum;
-    auto& regs = cpu.registers();
-    setflag(true, regs.flags, MASK_NEGATIVE);
-    setflag(true, regs.flags, MASK_HALFCARRY);
+    auto& flags = cpu.registers().get_flags();
+    setflag(true, flags, MASK_NEGATIVE);
+    setflag(true, flags, MASK_HALFCARRY);
 }
 PRINTER(CPL_A)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer, len, "CPL A"); }
 
-INSTRUCTION(SCF_CCF)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(SCF_CCF)(CPU& cpu, const uint8_t)
 {
-    auto& flags = cpu.registers().flags;
-    if ((opcode & 0x8) == 0)
+    auto& flags = cpu.registers().get_flags();
+    if constexpr ((OP & 0x8) == 0)
     {
         // Set CF
         flags |= MASK_CARRY;
@@ -310,14 +301,15 @@ PRINTER(SCF_CCF)(char* buffer, size_t len, CPU&, uint8_t opcode)
 }
 
 // ALU A, D / A, N
-INSTRUCTION(ALU_A_D)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(ALU_A_D)(CPU& cpu, const uint8_t)
 {
-    const uint8_t alu_op = (opcode >> 3) & 0x7;
+    constexpr uint8_t alu_op = (OP >> 3) & 0x7;
     // <alu> A, D
-    if ((opcode & 0x7) != 0x6) { cpu.registers().alu(alu_op, cpu.registers().getdest(opcode)); }
+    if constexpr ((OP & 0x7) != 0x6)
+    { cpu.registers().alu<alu_op>(cpu.registers().getdest<OP>()); }
     else
     {
-        cpu.registers().alu(alu_op, cpu.read_hl());
+        cpu.registers().alu<alu_op>(cpu.read_hl());
     }
 }
 PRINTER(ALU_A_D)(char* buffer, size_t len, CPU&, uint8_t opcode)
@@ -325,22 +317,22 @@ PRINTER(ALU_A_D)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "%s A, %s", cstr_alu(opcode >> 3), cstr_dest(opcode));
 }
 
-INSTRUCTION(ALU_A_N)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(ALU_A_N)(CPU& cpu, const uint8_t)
 {
-    const uint8_t alu_op = (opcode >> 3) & 0x7;
+    constexpr uint8_t alu_op = (OP >> 3) & 0x7;
     // <alu> A, N
     const uint8_t imm8 = cpu.readop8();
-    cpu.registers().alu(alu_op, imm8);
+    cpu.registers().alu<alu_op>(imm8);
 }
 PRINTER(ALU_A_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 {
     return snprintf(buffer, len, "%s A, 0x%02x", cstr_alu(opcode >> 3), cpu.peekop8(1));
 }
 
-INSTRUCTION(JP)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(JP)(CPU& cpu, const uint8_t)
 {
     const uint16_t dest = cpu.readop16();
-    if ((opcode & 1) || (cpu.registers().compare_flags(opcode)))
+    if ((OP & 1) || (cpu.registers().compare_flags<OP>()))
     {
         cpu.jump(dest);
         cpu.hardware_tick();
@@ -354,19 +346,19 @@ PRINTER(JP)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
     return snprintf(buffer, len, "JP 0x%04x (%s)", cpu.peekop16(1), temp);
 }
 
-INSTRUCTION(PUSH_POP)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(PUSH_POP)(CPU& cpu, const uint8_t)
 {
-    if (opcode & 4)
+    if constexpr (OP & 4)
     {
         // PUSH R
-        cpu.push_value(cpu.registers().getreg_af(opcode));
+        cpu.push_value(cpu.registers().getreg_af<OP>());
     }
     else
     {
         // POP R
-        cpu.registers().getreg_af(opcode) = cpu.mtread16(cpu.registers().sp);
+        cpu.registers().getreg_af<OP>() = cpu.mtread16(cpu.registers().sp);
         cpu.registers().sp += 2;
-        if (((opcode >> 4) & 0x3) == 0x3)
+        if constexpr (((OP >> 4) & 0x3) == 0x3)
         {
             // NOTE: POP AF requires clearing flag bits 0-3
             cpu.registers().flags &= 0xF0;
@@ -384,15 +376,15 @@ PRINTER(PUSH_POP)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
                     cpu.memory().read16(cpu.registers().sp));
 }
 
-INSTRUCTION(RET)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(RET)(CPU& cpu, const uint8_t)
 {
-    if ((opcode & 0xef) == 0xc9 || cpu.registers().compare_flags(opcode))
+    if ((OP & 0xef) == 0xc9 || cpu.registers().compare_flags<OP>())
     {
         cpu.registers().pc = cpu.mtread16(cpu.registers().sp);
         cpu.registers().sp += 2;
-        if (UNLIKELY(cpu.machine().verbose_instructions))
+        if (policy_t::verbose && UNLIKELY(cpu.machine().verbose_instructions))
         { printf("* Returned to 0x%04x\n", cpu.registers().pc); }
-        if (opcode != 0xc9)
+        if constexpr (OP != 0xc9)
         {
             cpu.hardware_tick(); // RET nzc needs one more tick
         }
@@ -411,16 +403,16 @@ INSTRUCTION(RETI)(CPU& cpu, const uint8_t)
 {
     cpu.registers().pc = cpu.mtread16(cpu.registers().sp);
     cpu.registers().sp += 2;
-    if (UNLIKELY(cpu.machine().verbose_instructions))
+    if (policy_t::verbose && UNLIKELY(cpu.machine().verbose_instructions))
     { printf("* Returned (w/interrupts) to 0x%04x\n", cpu.registers().pc); }
     cpu.hardware_tick();
     cpu.enable_interrupts();
 }
 PRINTER(RETI)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer, len, "RETI"); }
 
-INSTRUCTION(RST)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(RST)(CPU& cpu, const uint8_t)
 {
-    const uint16_t dst = opcode & 0x38;
+    constexpr uint16_t dst = OP & 0x38;
     if (UNLIKELY(cpu.registers().pc == dst + 1))
     {
         printf(">>> RST loop detected at vector 0x%04x\n", dst);
@@ -449,11 +441,11 @@ INSTRUCTION(STOP)(CPU& cpu, const uint8_t)
 }
 PRINTER(STOP)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer, len, "STOP"); }
 
-INSTRUCTION(JR_N)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(JR_N)(CPU& cpu, const uint8_t)
 {
     const imm8_t disp{.u8 = cpu.readop8()};
     cpu.hardware_tick();
-    if (opcode == 0x18 || (cpu.registers().compare_flags(opcode)))
+    if (OP == 0x18 || (cpu.registers().compare_flags<OP>()))
     { cpu.jump(cpu.registers().pc + disp.s8); }
 }
 PRINTER(JR_N)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
@@ -479,10 +471,10 @@ INSTRUCTION(HALT)(CPU& cpu, const uint8_t)
 }
 PRINTER(HALT)(char* buffer, size_t len, CPU&, uint8_t) { return snprintf(buffer, len, "HALT"); }
 
-INSTRUCTION(CALL)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(CALL)(CPU& cpu, const uint8_t)
 {
     const uint16_t dest = cpu.readop16();
-    if ((opcode & 1) || cpu.registers().compare_flags(opcode))
+    if ((OP & 1) || cpu.registers().compare_flags<OP>())
     {
         // push address of **next** instr
         cpu.push_and_jump(dest);
@@ -501,9 +493,10 @@ INSTRUCTION(ADD_SP_N)(CPU& cpu, const uint8_t)
     const imm8_t imm{.u8 = cpu.readop8()};
     auto& regs = cpu.registers();
     const int calc = (regs.sp + imm.s8) & 0xFFFF;
-    regs.flags = 0;
-    setflag(((regs.sp ^ imm.s8 ^ calc) & 0x100) == 0x100, regs.flags, MASK_CARRY);
-    setflag(((regs.sp ^ imm.s8 ^ calc) & 0x10) == 0x10, regs.flags, MASK_HALFCARRY);
+    auto& flags = regs.overwrite_flags();
+    flags = 0;
+    setflag(((regs.sp ^ imm.s8 ^ calc) & 0x100) == 0x100, flags, MASK_CARRY);
+    setflag(((regs.sp ^ imm.s8 ^ calc) & 0x10) == 0x10, flags, MASK_HALFCARRY);
     cpu.registers().sp = calc;
     cpu.hardware_tick();
     cpu.hardware_tick();
@@ -513,24 +506,23 @@ PRINTER(ADD_SP_N)(char* buffer, size_t len, CPU& cpu, uint8_t)
     return snprintf(buffer, len, "ADD SP, 0x%02x", cpu.peekop8(1));
 }
 
-INSTRUCTION(LD_FF00_A)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_FF00_A)(CPU& cpu, const uint8_t)
 {
-    switch (opcode)
+    if constexpr (OP == 0xE2)
+    { cpu.mtwrite8(0xFF00 + cpu.registers().c, cpu.registers().accum); }
+    else if constexpr (OP == 0xF2)
     {
-    case 0xE2:
-        cpu.mtwrite8(0xFF00 + cpu.registers().c, cpu.registers().accum);
-        return;
-    case 0xF2:
         cpu.registers().accum = cpu.mtread8(0xFF00 + cpu.registers().c);
-        return;
-    case 0xE0:
+    }
+    else if constexpr (OP == 0xE0)
+    {
         cpu.mtwrite8(0xFF00 + cpu.readop8(), cpu.registers().accum);
-        return;
-    case 0xF0:
+    }
+    else
+    {
+        static_assert(OP == 0xF0, "Unknown opcode in LD (FF00) handler");
         cpu.registers().accum = cpu.mtread8(0xFF00 + cpu.readop8());
-        return;
     }
-    GBC_ASSERT(0);
 }
 PRINTER(LD_FF00_A)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
 {
@@ -548,17 +540,16 @@ PRINTER(LD_FF00_A)(char* buffer, size_t len, CPU& cpu, uint8_t opcode)
     GBC_ASSERT(0);
 }
 
-INSTRUCTION(LD_HL_SP)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(LD_HL_SP)(CPU& cpu, const uint8_t)
 {
-    if (opcode == 0xF8)
+    if constexpr (OP == 0xF8)
     {
         // the ADD operation is signed
         const imm8_t imm{.u8 = cpu.readop8()};
-        cpu.registers().flags = 0;
-        setflag(((cpu.registers().sp & 0xf) + (imm.u8 & 0x0f)) & 0x10, cpu.registers().flags,
-                MASK_HALFCARRY);
-        setflag(((cpu.registers().sp & 0xff) + (imm.u8 & 0xff)) & 0x100, cpu.registers().flags,
-                MASK_CARRY);
+        auto& flags = cpu.registers().overwrite_flags();
+        flags = 0;
+        setflag(((cpu.registers().sp & 0xf) + (imm.u8 & 0x0f)) & 0x10, flags, MASK_HALFCARRY);
+        setflag(((cpu.registers().sp & 0xff) + (imm.u8 & 0xff)) & 0x100, flags, MASK_CARRY);
         cpu.registers().hl = cpu.registers().sp + imm.s8;
     }
     else
@@ -579,9 +570,9 @@ PRINTER(JP_HL)(char* buffer, size_t len, CPU& cpu, uint8_t)
     return snprintf(buffer, len, "JP HL (HL=%04X)", cpu.registers().hl);
 }
 
-INSTRUCTION(DI_EI)(CPU& cpu, const uint8_t opcode)
+INSTRUCTION(DI_EI)(CPU& cpu, const uint8_t)
 {
-    if (opcode & 0x08) { cpu.enable_interrupts(); }
+    if constexpr (OP & 0x08) { cpu.enable_interrupts(); }
     else
     {
         cpu.disable_interrupts();
@@ -593,45 +584,45 @@ PRINTER(DI_EI)(char* buffer, size_t len, CPU&, uint8_t opcode)
     return snprintf(buffer, len, "%s", mnemonic);
 }
 
-INSTRUCTION(CB_EXT)(CPU& cpu, const uint8_t)
+// CB-prefixed instructions, specialized for each extended opcode (OP)
+INSTRUCTION(CB)(CPU& cpu, const uint8_t)
 {
-    const uint8_t opcode = cpu.readop8();
-    const bool HL = (opcode & 0x7) == 0x6;
+    constexpr bool HL = (OP & 0x7) == 0x6;
     uint8_t reg;
-    if (!HL)
-        reg = cpu.registers().getdest(opcode);
+    if constexpr (!HL)
+        reg = cpu.registers().getdest<OP>();
     else
         reg = cpu.read_hl();
 
     // BIT, RESET, SET
-    if (opcode >> 6)
+    if constexpr (OP >> 6)
     {
-        const uint8_t bit = (opcode >> 3) & 7;
-        switch (opcode >> 6)
-        {
-        case 0x1:
+        constexpr uint8_t bit = (OP >> 3) & 7;
+        if constexpr ((OP >> 6) == 0x1)
         { // BIT
             const int set = reg & (1 << bit);
             // set flags
-            cpu.registers().flags &= ~MASK_NEGATIVE;
-            cpu.registers().flags |= MASK_HALFCARRY;
-            setflag(set == 0, cpu.registers().flags, MASK_ZERO);
+            auto& flags = cpu.registers().get_flags();
+            flags &= ~MASK_NEGATIVE;
+            flags |= MASK_HALFCARRY;
+            setflag(set == 0, flags, MASK_ZERO);
             // BIT only takes 8/12 T-cycles
             return;
         }
-        case 0x2: // RESET
+        else if constexpr ((OP >> 6) == 0x2)
+        { // RESET
             reg &= ~(1 << bit);
-            break;
-        case 0x3: // SET
+        }
+        else
+        { // SET
             reg |= 1 << bit;
-            break;
         }
     }
-    else if ((opcode & 0xF0) == 0x00)
+    else if constexpr ((OP & 0xF0) == 0x00)
     {
-        auto& flags = cpu.registers().flags;
+        auto& flags = cpu.registers().overwrite_flags();
         flags = 0;
-        if (opcode & 0x8)
+        if constexpr (OP & 0x8)
         {
             // RRC D, rotate D right, keep old bit0
             setflag(reg & 0x1, flags, MASK_CARRY); // old bit0 to CF
@@ -643,17 +634,17 @@ INSTRUCTION(CB_EXT)(CPU& cpu, const uint8_t)
             setflag(reg & 0x80, flags, MASK_CARRY); // old bit7 to CF
             reg = (reg << 1) | (reg >> 7);
         }
-        setflag(reg == 0, cpu.registers().flags, MASK_ZERO);
+        setflag(reg == 0, flags, MASK_ZERO);
     }
-    else if ((opcode & 0xF0) == 0x10)
+    else if constexpr ((OP & 0xF0) == 0x10)
     {
-        auto& flags = cpu.registers().flags;
-        // NOTE: dont reset flags here
-        if (opcode & 0x8)
+        const uint8_t carry = cpu.registers().carry();
+        auto& flags = cpu.registers().overwrite_flags();
+        if constexpr (OP & 0x8)
         {
             // RR D, rotate D right through carry, old CF to bit 7
             const uint8_t bit0 = reg & 0x1;
-            reg = (reg >> 1) | ((flags & MASK_CARRY) << 3);
+            reg = (reg >> 1) | (carry << 7);
             flags = 0;
             setflag(bit0, flags, MASK_CARRY); // old bit0 to CF
         }
@@ -661,17 +652,17 @@ INSTRUCTION(CB_EXT)(CPU& cpu, const uint8_t)
         {
             // RL D, rotate D left through carry, old CF to bit 0
             const uint8_t bit7 = reg & 0x80;
-            reg = (reg << 1) | ((flags & MASK_CARRY) >> 4);
+            reg = (reg << 1) | carry;
             flags = 0;
             setflag(bit7, flags, MASK_CARRY); // old bit7 to CF
         }
         setflag(reg == 0, flags, MASK_ZERO);
     }
-    else if ((opcode & 0xF0) == 0x20)
+    else if constexpr ((OP & 0xF0) == 0x20)
     {
-        auto& flags = cpu.registers().flags;
+        auto& flags = cpu.registers().overwrite_flags();
         flags = 0;
-        if (opcode & 0x8)
+        if constexpr (OP & 0x8)
         {
             // SRA D
             setflag(reg & 0x1, flags, MASK_CARRY);
@@ -684,40 +675,34 @@ INSTRUCTION(CB_EXT)(CPU& cpu, const uint8_t)
             setflag(reg & 0x80, flags, MASK_CARRY);
             reg <<= 1;
         }
-        setflag(reg == 0, cpu.registers().flags, MASK_ZERO);
+        setflag(reg == 0, flags, MASK_ZERO);
     }
-    else if ((opcode & 0xf0) == 0x30)
+    else
     {
-        if ((opcode & 0x8) == 0x0)
+        if constexpr ((OP & 0x8) == 0x0)
         {
             // SWAP D
             reg = (reg >> 4) | (reg << 4);
-            cpu.registers().flags = 0;
-            setflag(reg == 0, cpu.registers().flags, MASK_ZERO);
+            cpu.registers().overwrite_flags() = (reg == 0) ? MASK_ZERO : 0;
         }
         else
         {
             // SRL D (logical)
-            cpu.registers().flags = 0;
-            setflag(reg & 0x1, cpu.registers().flags, MASK_CARRY);
+            auto& flags = cpu.registers().overwrite_flags();
+            flags = 0;
+            setflag(reg & 0x1, flags, MASK_CARRY);
             reg >>= 1;
-            setflag(reg == 0, cpu.registers().flags, MASK_ZERO);
+            setflag(reg == 0, flags, MASK_ZERO);
         }
     }
-    else
-    {
-        fprintf(stderr, "Missing instruction: %#x\n", opcode);
-        GBC_ASSERT(0 && "Unimplemented extended instruction");
-    }
     // all instructions on this opcode go into the same dest
-    if (!HL)
-        cpu.registers().getdest(opcode) = reg;
+    if constexpr (!HL)
+        cpu.registers().getdest<OP>() = reg;
     else
         cpu.write_hl(reg);
 }
-PRINTER(CB_EXT)(char* buffer, size_t len, CPU& cpu, uint8_t)
+PRINTER(CB)(char* buffer, size_t len, CPU&, uint8_t opcode)
 {
-    const uint8_t opcode = cpu.peekop8(1);
     if (opcode >> 6)
     {
         const char* mnemonic[] = {"IMPLEMENT ME", "BIT", "RES", "SET"};
@@ -731,6 +716,29 @@ PRINTER(CB_EXT)(char* buffer, size_t len, CPU& cpu, uint8_t)
     }
 }
 
+template <uint8_t OP>
+constexpr instruction_t cb_instruction()
+{
+    return INSTR(CB);
+}
+template <size_t... OP>
+constexpr std::array<instruction_t, 256> cb_instruction_table(std::index_sequence<OP...>)
+{
+    return {cb_instruction<OP>()...};
+}
+static constexpr auto cb_instructions = cb_instruction_table(std::make_index_sequence<256>{});
+
+INSTRUCTION(CB_EXT)(CPU& cpu, const uint8_t)
+{
+    const uint8_t opcode = cpu.readop8();
+    cb_instructions[opcode].handler(cpu, opcode);
+}
+PRINTER(CB_EXT)(char* buffer, size_t len, CPU& cpu, uint8_t)
+{
+    const uint8_t opcode = cpu.peekop8(1);
+    return printer_CB(buffer, len, cpu, opcode);
+}
+
 INSTRUCTION(MISSING)(CPU& cpu, const uint8_t opcode)
 {
     fprintf(stderr, "Missing instruction: %#x\n", opcode);
@@ -742,37 +750,48 @@ PRINTER(MISSING)(char* buffer, size_t len, CPU&, const uint8_t opcode)
     return snprintf(buffer, len, "MISSING opcode 0x%02x", opcode);
 }
 
-DEF_INSTR(NOP);
-DEF_INSTR(LD_N_SP);
-DEF_INSTR(LD_R_N);
-DEF_INSTR(ADD_HL_R);
-DEF_INSTR(LD_R_A_R);
-DEF_INSTR(INC_DEC_R);
-DEF_INSTR(INC_DEC_D);
-DEF_INSTR(LD_D_N);
-DEF_INSTR(LD_D_D);
-DEF_INSTR(LD_N_A_N);
-DEF_INSTR(JR_N);
-DEF_INSTR(RLC_RRC);
-DEF_INSTR(LDID_HL_A);
-DEF_INSTR(DAA);
-DEF_INSTR(CPL_A);
-DEF_INSTR(SCF_CCF);
-DEF_INSTR(HALT);
-DEF_INSTR(ALU_A_D);
-DEF_INSTR(ALU_A_N);
-DEF_INSTR(PUSH_POP);
-DEF_INSTR(RST);
-DEF_INSTR(RET);
-DEF_INSTR(RETI);
-DEF_INSTR(STOP);
-DEF_INSTR(JP);
-DEF_INSTR(CALL);
-DEF_INSTR(ADD_SP_N);
-DEF_INSTR(LD_FF00_A);
-DEF_INSTR(LD_HL_SP);
-DEF_INSTR(JP_HL);
-DEF_INSTR(DI_EI);
-DEF_INSTR(CB_EXT);
-DEF_INSTR(MISSING);
+// select the specialized instruction for each opcode at compile-time
+template <uint8_t OP>
+constexpr instruction_t instruction()
+{
+    if constexpr (OP == 0x00) return INSTR(NOP);
+    else if constexpr (OP == 0x08) return INSTR(LD_N_SP); // LD (imm16), SP
+    else if constexpr (OP == 0x10) return INSTR(STOP);
+    else if constexpr (OP == 0x76) return INSTR(HALT); // NOTE: not LD (HL), (HL)
+    else if constexpr ((OP & 0xC7) == 0x06) return INSTR(LD_D_N);    // LD D, imm8
+    else if constexpr ((OP & 0xC0) == 0x40) return INSTR(LD_D_D);    // LD D, D
+    else if constexpr ((OP & 0xE7) == 0x02) return INSTR(LD_R_A_R);  // LD (R), A / LD A, (R)
+    else if constexpr ((OP & 0xEF) == 0xEA) return INSTR(LD_N_A_N);  // LD (imm16), A / A, (imm16)
+    else if constexpr ((OP & 0xE7) == 0x22) return INSTR(LDID_HL_A); // LDI / LDD
+    else if constexpr ((OP & 0xED) == 0xE0) return INSTR(LD_FF00_A); // LD (FF00+C/imm8)
+    else if constexpr ((OP & 0xCF) == 0x01) return INSTR(LD_R_N);    // LD R, imm16
+    else if constexpr (OP == 0xE8) return INSTR(ADD_SP_N);
+    else if constexpr ((OP & 0xFE) == 0xF8) return INSTR(LD_HL_SP);  // LD HL, SP+imm8 / SP, HL
+    else if constexpr ((OP & 0xCB) == 0xC1) return INSTR(PUSH_POP);  // PUSH R / POP R
+    else if constexpr ((OP & 0xC0) == 0x80) return INSTR(ALU_A_D);   // ALU A, D
+    else if constexpr ((OP & 0xC7) == 0xC6) return INSTR(ALU_A_N);   // ALU A, imm8
+    else if constexpr ((OP & 0xC7) == 0x03) return INSTR(INC_DEC_R); // INC R / DEC R
+    else if constexpr ((OP & 0xC6) == 0x04) return INSTR(INC_DEC_D); // INC D / DEC D
+    else if constexpr ((OP & 0xCF) == 0x09) return INSTR(ADD_HL_R);  // ADD HL, R
+    else if constexpr (OP == 0x27) return INSTR(DAA);
+    else if constexpr (OP == 0x2F) return INSTR(CPL_A);
+    else if constexpr ((OP & 0xF7) == 0x37) return INSTR(SCF_CCF);
+    else if constexpr ((OP & 0xE7) == 0x07) return INSTR(RLC_RRC); // RLC/RRC/RL/RR A
+    else if constexpr (OP == 0xC3 || (OP & 0xE7) == 0xC2) return INSTR(JP);
+    else if constexpr (OP == 0xE9) return INSTR(JP_HL);
+    else if constexpr (OP == 0x18 || (OP & 0xE7) == 0x20) return INSTR(JR_N);
+    else if constexpr (OP == 0xCD || (OP & 0xE7) == 0xC4) return INSTR(CALL);
+    else if constexpr (OP == 0xC9 || (OP & 0xE7) == 0xC0) return INSTR(RET);
+    else if constexpr (OP == 0xD9) return INSTR(RETI);
+    else if constexpr ((OP & 0xC7) == 0xC7) return INSTR(RST);
+    else if constexpr ((OP & 0xF7) == 0xF3) return INSTR(DI_EI);
+    else if constexpr (OP == 0xCB) return INSTR(CB_EXT);
+    else return INSTR(MISSING);
+}
+template <size_t... OP>
+constexpr std::array<instruction_t, 256> instruction_table(std::index_sequence<OP...>)
+{
+    return {instruction<OP>()...};
+}
+static constexpr auto instructions = instruction_table(std::make_index_sequence<256>{});
 } // namespace gbc
@@ -5,6 +5,8 @@
 
 namespace gbc
 {
+static constexpr std::array<uint32_t, 4> TIMA_CYCLES = {1024, 16, 64, 256};
+
 IO::IO(Machine& mach)
     : vblank{0x1, 0x40, "V-blank"}
     , lcd_stat{0x2, 0x48, "LCD Status"}
@@ -13,10 +15,17 @@ IO::IO(Machine& mach)
     , joypadint{0x10, 0x60, "Joypad"}
     , debugint{0x0, 0x0, "Debug"}
     , m_machine(mach)
+    , m_iologic(dmg_iologic.data())
+    , m_state() // zeroed, padding included
 {
     this->reset();
 }
 
+void IO::set_cgb_mode(const bool cgb)
+{
+    this->m_iologic = cgb ? cgb_iologic.data() : dmg_iologic.data();
+}
+
 void IO::reset()
 {
     // register defaults
@@ -43,42 +52,15 @@ void IO::reset()
     reg(REG_HDMA5) = 0xFF;
 
     this->m_state.reg_ie = 0x00;
+    this->m_timer_ticks = 0;
+    this->m_timer_deadline = this->timer_deadline();
 }
 
 void IO::simulate()
 {
-    // 1. DIV timer
-    this->m_state.divider += 256 / 64;
-    this->reg(REG_DIV) = this->m_state.divider >> 8;
-
-    // 2. TIMA timer
-    if (this->reg(REG_TAC) & 0x4)
-    {
-        const std::array<int, 4> TIMA_CYCLES = {1024, 16, 64, 256};
-        const int speed = this->reg(REG_TAC) & 0x3;
-        // TIMA counter timer
-        if (m_state.divider % (TIMA_CYCLES[speed]) == 0)
-        {
-            this->reg(REG_TIMA)++;
-            // if (reg(REG_TIMA) > 16) machine().break_now();
-            // timer interrupt when overflowing to 0
-            if (this->reg(REG_TIMA) == 0)
-            {
-                this->trigger(this->timerint);
-                // BUG: TIMA does not get reset before after 4 cycles
-                this->m_state.timabug = 4;
-            }
-        }
-        else if (UNLIKELY(this->m_state.timabug > 0))
-        {
-            this->m_state.timabug--;
-            if (this->m_state.timabug == 0)
-            {
-                // restart at modulo
-                this->reg(REG_TIMA) = this->reg(REG_TMA);
-            }
-        }
-    }
+    // 1. and 2. DIV and TIMA timers, counted until they have more to do
+    this->m_timer_ticks++;
+    if (UNLIKELY(m_timer_ticks >= m_timer_deadline)) this->tick_timer();
 
     // 3. OAM DMA operation
     if (this->m_state.dma.bytes_left > 0)
@@ -121,17 +103,93 @@ void IO::simulate()
     }
 }
 
+uint64_t IO::ticks_to_event() const noexcept
+{
+    // DMA transfers, and the delayed TIMA reload, happen tick by tick
+    if (m_state.dma.bytes_left > 0) return 1;
+    if (hdma().bytes_left > 0 && m_machine.gpu.is_hblank() && hdma().cur_line != reg(REG_LY))
+        return 1;
+    if ((reg(REG_TAC) & 0x4) == 0) return NO_EVENT_TICKS;
+    return m_timer_deadline - m_timer_ticks;
+}
+void IO::advance(const uint64_t ticks) noexcept { this->m_timer_ticks += ticks; }
+
+void IO::sync_timer() noexcept
+{
+    if (m_timer_ticks == 0) return;
+    // plain counting, as there is no overflow before the deadline
+    const uint64_t cycles = 4 * m_timer_ticks;
+    if (reg(REG_TAC) & 0x4)
+    {
+        const uint32_t period = TIMA_CYCLES[reg(REG_TAC) & 0x3];
+        this->reg(REG_TIMA) += (m_state.divider % period + cycles) / period;
+    }
+    this->m_state.divider += cycles;
+    this->reg(REG_DIV) = this->m_state.divider >> 8;
+    if (m_timer_deadline != NO_EVENT_TICKS) this->m_timer_deadline -= m_timer_ticks;
+    this->m_timer_ticks = 0;
+}
+void IO::timer_written() noexcept { this->m_timer_deadline = this->timer_deadline(); }
+// ticks until the timer does more than count: the next TIMA overflow, or
+// each tick of the delayed reload
+uint64_t IO::timer_deadline() const noexcept
+{
+    if ((reg(REG_TAC) & 0x4) == 0) return NO_EVENT_TICKS;
+    if (m_state.timabug > 0) return 1;
+    const uint32_t period = TIMA_CYCLES[reg(REG_TAC) & 0x3];
+    const uint32_t first = (period - m_state.divider % period) / 4;
+    return first + (0xFF - reg(REG_TIMA)) * (period / 4);
+}
+void IO::tick_timer()
+{
+    // the ticks before this one only counted
+    this->m_timer_ticks--;
+    this->sync_timer();
+    this->m_state.divider += 256 / 64;
+    this->reg(REG_DIV) = this->m_state.divider >> 8;
+
+    if (this->reg(REG_TAC) & 0x4)
+    {
+        const int speed = this->reg(REG_TAC) & 0x3;
+        // TIMA counter timer
+        if (m_state.divider % (TIMA_CYCLES[speed]) == 0)
+        {
+            this->reg(REG_TIMA)++;
+            // if (reg(REG_TIMA) > 16) machine().break_now();
+            // timer interrupt when overflowing to 0
+            if (this->reg(REG_TIMA) == 0)
+            {
+                this->trigger(this->timerint);
+                // BUG: TIMA does not get reset before after 4 cycles
+                this->m_state.timabug = 4;
+            }
+        }
+        else if (UNLIKELY(this->m_state.timabug > 0))
+        {
+            this->m_state.timabug--;
+            if (this->m_state.timabug == 0)
+            {
+                // restart at modulo
+                this->reg(REG_TIMA) = this->reg(REG_TMA);
+            }
+        }
+    }
+    this->m_timer_ticks = 0;
+    this->m_timer_deadline = this->timer_deadline();
+}
+
 uint8_t IO::read_io(const uint16_t addr)
 {
+    machine().cpu.sync_hardware();
     // default: just return the register value
     if (addr >= 0xff00 && addr < 0xff80)
     {
-        if (UNLIKELY(machine().break_on_io && !machine().is_breaking()))
+        if (policy_t::breakpoints && UNLIKELY(machine().break_on_io && !machine().is_breaking()))
         {
             printf("[io] * I/O read 0x%04x => 0x%02x\n", addr, reg(addr));
             machine().break_now();
         }
-        auto& handler = iologic.at(addr - 0xff00);
+        const auto& handler = m_iologic[addr - 0xff00];
         if (handler.on_read != nullptr) { return handler.on_read(*this, addr); }
         return reg(addr);
     }
@@ -142,22 +200,22 @@ uint8_t IO::read_io(const uint16_t addr)
 }
 void IO::write_io(const uint16_t addr, uint8_t value)
 {
+    machine().cpu.sync_hardware();
     // default: just write to register
     if (addr >= 0xff00 && addr < 0xff80)
     {
-        if (UNLIKELY(machine().break_on_io && !machine().is_breaking()))
+        if (policy_t::breakpoints && UNLIKELY(machine().break_on_io && !machine().is_breaking()))
         {
             printf("[io] * I/O write 0x%04x value 0x%02x\n", addr, value);
             machine().break_now();
         }
-        auto& handler = iologic.at(addr - 0xff00);
+        const auto& handler = m_iologic[addr - 0xff00];
         if (handler.on_write != nullptr)
-        {
             handler.on_write(*this, addr, value);
-            return;
-        }
-        // default: just write...
-        reg(addr) = value;
+        else // default: just write...
+            reg(addr) = value;
+        // the write may have changed when the next event happens
+        machine().cpu.reschedule();
         return;
     }
     if (addr == REG_IE)
@@ -218,13 +276,17 @@ void IO::deactivate_stop()
 
 void IO::reset_divider()
 {
+    this->sync_timer();
     this->m_state.divider = 0;
     this->reg(REG_DIV) = 0;
+    this->timer_written();
 }
 
 int IO::restore_state(const std::vector<uint8_t>& data, int off)
 {
     this->m_state = *(state_t*) &data.at(off);
+    this->m_timer_ticks = 0;
+    this->m_timer_deadline = this->timer_deadline();
     return sizeof(m_state);
 }
 void IO::serialize_state(std::vector<uint8_t>& res) const
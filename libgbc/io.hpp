@@ -6,6 +6,7 @@
 
 namespace gbc
 {
+struct iowrite_t;
 class IO
 {
 public:
@@ -97,11 +98,21 @@ public:
     void perform_stop();
     void deactivate_stop();
     void reset_divider();
+    // DIV and TIMA are brought up to date before they are read or written,
+    // and the next timer event has to be found again after a write
+    void sync_timer() noexcept;
+    void timer_written() noexcept;
 
     Machine& machine() noexcept { return m_machine; }
+    // handle the CGB registers, or ignore them like a DMG
+    void set_cgb_mode(bool cgb);
 
     void reset();
     void simulate();
+    // number of ticks until simulate() does more than counting, and
+    // skipping over ticks before that
+    uint64_t ticks_to_event() const noexcept;
+    void advance(uint64_t ticks) noexcept;
 
     inline uint8_t& reg(const uint16_t addr) { return m_state.ioregs[addr & 0x7f]; }
     inline const uint8_t& reg(const uint16_t addr) const { return m_state.ioregs[addr & 0x7f]; }
@@ -142,12 +153,15 @@ private:
         uint16_t dst;
         int32_t bytes_left = 0;
     };
+    uint64_t timer_deadline() const noexcept;
+    void tick_timer();
     const dma_t& oam_dma() const noexcept { return m_state.dma; }
     dma_t& oam_dma() noexcept { return m_state.dma; }
     const dma_t& hdma() const noexcept { return m_state.hdma; }
     dma_t& hdma() noexcept { return m_state.hdma; }
 
     Machine& m_machine;
+    const iowrite_t* m_iologic;
     struct state_t
     {
         std::array<uint8_t, 128> ioregs = {};
@@ -161,6 +175,10 @@ private:
         dma_t dma;
         dma_t hdma;
     } m_state;
+    // ticks the timer has not counted yet, and the number of ticks after
+    // which it has to do more than count
+    uint64_t m_timer_ticks = 0;
+    uint64_t m_timer_deadline = NO_EVENT_TICKS;
 
     joypad_read_handler_t m_jp_handler = nullptr;
 };
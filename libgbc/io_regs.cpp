@@ -1,6 +1,6 @@
 #include "machine.hpp"
 // should only be included once
-#define IOHANDLER(off, x) new (&iologic.at(off - 0xff00)) iowrite_t{iowrite_##x, ioread_##x};
+#define IOHANDLER(table, off, x) new (&table.at(off - 0xff00)) iowrite_t{iowrite_##x, ioread_##x};
 
 namespace gbc
 {
@@ -11,7 +11,9 @@ struct iowrite_t
     const write_handler_t on_write = nullptr;
     const read_handler_t on_read = nullptr;
 };
-static std::array<iowrite_t, 128> iologic = {};
+// a DMG doesn't have any of the CGB registers
+static std::array<iowrite_t, 128> dmg_iologic = {};
+static std::array<iowrite_t, 128> cgb_iologic = {};
 
 void iowrite_JOYP(IO& io, uint16_t, uint8_t value)
 {
@@ -38,7 +40,23 @@ void iowrite_DIV(IO& io, uint16_t, uint8_t)
     // writing to DIV resets it to 0
     io.reset_divider();
 }
-uint8_t ioread_DIV(IO& io, uint16_t) { return io.reg(IO::REG_DIV); }
+uint8_t ioread_DIV(IO& io, uint16_t)
+{
+    io.sync_timer();
+    return io.reg(IO::REG_DIV);
+}
+// TIMA and TAC change when the next overflow happens
+void iowrite_TIMER(IO& io, uint16_t addr, uint8_t value)
+{
+    io.sync_timer();
+    io.reg(addr) = value;
+    io.timer_written();
+}
+uint8_t ioread_TIMER(IO& io, uint16_t addr)
+{
+    io.sync_timer();
+    return io.reg(addr);
+}
 
 void iowrite_LCDC(IO& io, uint16_t addr, uint8_t value)
 {
@@ -73,7 +91,6 @@ uint8_t ioread_DMA(IO& io, uint16_t addr) { return io.reg(addr); }
 
 void iowrite_HDMA(IO& io, uint16_t addr, uint8_t value)
 {
-    if (io.machine().is_cgb() == false) return;
     switch (addr)
     {
     case IO::REG_HDMA1:
@@ -149,7 +166,6 @@ void iowrite_KEY1(IO& io, uint16_t addr, uint8_t value)
 }
 uint8_t ioread_KEY1(IO& io, uint16_t addr)
 {
-    if (!io.machine().is_cgb()) return 0xff;
     return (io.reg(addr) & 0x81) | 0x7E;
 }
 
@@ -210,26 +226,40 @@ uint8_t ioread_OBPD(IO& io, uint16_t)
     return io.machine().gpu.getpal(64 + idx);
 }
 
+// CGB registers on a DMG: writes are ignored, and reads return all ones
+void iowrite_NONE(IO&, uint16_t, uint8_t) {}
+uint8_t ioread_NONE(IO&, uint16_t) { return 0xff; }
+
 __attribute__((constructor)) static void set_io_handlers()
 {
-    IOHANDLER(IO::REG_P1, JOYP);
-    IOHANDLER(IO::REG_DIV, DIV);
-    IOHANDLER(IO::REG_LCDC, LCDC);
-    IOHANDLER(IO::REG_STAT, STAT);
-    IOHANDLER(IO::REG_DMA, DMA);
-    IOHANDLER(IO::REG_NR52, AUDIO);
+    for (auto* both : {&dmg_iologic, &cgb_iologic})
+    {
+        auto& table = *both;
+        IOHANDLER(table, IO::REG_P1, JOYP);
+        IOHANDLER(table, IO::REG_DIV, DIV);
+        IOHANDLER(table, IO::REG_TIMA, TIMER);
+        IOHANDLER(table, IO::REG_TAC, TIMER);
+        IOHANDLER(table, IO::REG_LCDC, LCDC);
+        IOHANDLER(table, IO::REG_STAT, STAT);
+        IOHANDLER(table, IO::REG_DMA, DMA);
+        IOHANDLER(table, IO::REG_NR52, AUDIO);
+        IOHANDLER(table, IO::REG_BOOT, BOOT);
+    }
     // CGB registers
-    IOHANDLER(IO::REG_KEY1, KEY1);
-    IOHANDLER(IO::REG_VBK, VBK);
-    IOHANDLER(IO::REG_SVBK, SVBK);
-    IOHANDLER(IO::REG_BOOT, BOOT);
-    IOHANDLER(IO::REG_HDMA1, HDMA);
-    IOHANDLER(IO::REG_HDMA2, HDMA);
-    IOHANDLER(IO::REG_HDMA3, HDMA);
-    IOHANDLER(IO::REG_HDMA4, HDMA);
-    IOHANDLER(IO::REG_HDMA5, HDMA);
+    IOHANDLER(cgb_iologic, IO::REG_KEY1, KEY1);
+    IOHANDLER(cgb_iologic, IO::REG_VBK, VBK);
+    IOHANDLER(cgb_iologic, IO::REG_SVBK, SVBK);
+    IOHANDLER(cgb_iologic, IO::REG_HDMA1, HDMA);
+    IOHANDLER(cgb_iologic, IO::REG_HDMA2, HDMA);
+    IOHANDLER(cgb_iologic, IO::REG_HDMA3, HDMA);
+    IOHANDLER(cgb_iologic, IO::REG_HDMA4, HDMA);
+    IOHANDLER(cgb_iologic, IO::REG_HDMA5, HDMA);
     // CGB palettes
-    IOHANDLER(IO::REG_BGPD, BGPD);
-    IOHANDLER(IO::REG_OBPD, OBPD);
+    IOHANDLER(cgb_iologic, IO::REG_BGPD, BGPD);
+    IOHANDLER(cgb_iologic, IO::REG_OBPD, OBPD);
+    for (const uint16_t reg : {IO::REG_KEY1, IO::REG_VBK, IO::REG_SVBK, IO::REG_HDMA1,
+                               IO::REG_HDMA2, IO::REG_HDMA3, IO::REG_HDMA4, IO::REG_HDMA5,
+                               IO::REG_BGPD, IO::REG_OBPD})
+    { IOHANDLER(dmg_iologic, reg, NONE); }
 }
 } // namespace gbc
@@ -0,0 +1,361 @@
+#include "jit.hpp"
+
+#include "machine.hpp"
+#include <cstring>
+#include <initializer_list>
+#include <sys/mman.h>
+
+namespace gbc
+{
+static constexpr size_t REGION_SIZE = 1024 * 1024;
+
+// a tiny x86-64 assembler, where RBX always points to the guest registers
+struct Emitter
+{
+    std::vector<uint8_t> code;
+
+    void bytes(std::initializer_list<uint8_t> list) { code.insert(code.end(), list); }
+    void imm(uint64_t value, int size)
+    {
+        for (int i = 0; i < size; i++) { code.push_back(value >> (i * 8)); }
+    }
+    // opcode with a [RBX + disp32] operand
+    void rbx(std::initializer_list<uint8_t> opcode, uint8_t reg, size_t disp)
+    {
+        this->bytes(opcode);
+        code.push_back(0x83 | (reg << 3));
+        this->imm(disp, 4);
+    }
+    void call(const void* func)
+    {
+        this->bytes({0x48, 0xB8}); // MOV RAX, imm64
+        this->imm((uintptr_t) func, 8);
+        this->bytes({0xFF, 0xD0}); // CALL RAX
+    }
+    void mov_rdi(const void* ptr)
+    {
+        this->bytes({0x48, 0xBF});
+        this->imm((uintptr_t) ptr, 8);
+    }
+    void store_ptr(const void* dst, const void* value)
+    {
+        this->bytes({0x48, 0xB9}); // MOV RCX, dst
+        this->imm((uintptr_t) dst, 8);
+        this->bytes({0x48, 0xB8}); // MOV RAX, value
+        this->imm((uintptr_t) value, 8);
+        this->bytes({0x48, 0x89, 0x01}); // MOV [RCX], RAX
+    }
+    // Jcc rel32, returning the position to patch
+    size_t jcc(const uint8_t cc)
+    {
+        this->bytes({0x0F, cc});
+        this->imm(0, 4);
+        return code.size();
+    }
+    size_t jz() { return this->jcc(0x84); }
+    size_t jb() { return this->jcc(0x82); }
+    void patch(size_t pos)
+    {
+        const uint32_t rel = code.size() - pos;
+        std::memcpy(&code[pos - 4], &rel, 4);
+    }
+};
+
+static size_t reg8(const uint8_t idx)
+{
+    switch (idx & 0x7)
+    {
+    case 0:
+        return offsetof(regs_t, b);
+    case 1:
+        return offsetof(regs_t, c);
+    case 2:
+        return offsetof(regs_t, d);
+    case 3:
+        return offsetof(regs_t, e);
+    case 4:
+        return offsetof(regs_t, h);
+    case 5:
+        return offsetof(regs_t, l);
+    case 7:
+        return offsetof(regs_t, accum);
+    }
+    GBC_ASSERT(0);
+}
+static size_t reg16(const uint8_t opcode)
+{
+    switch ((opcode >> 4) & 0x3)
+    {
+    case 0:
+        return offsetof(regs_t, bc);
+    case 1:
+        return offsetof(regs_t, de);
+    case 2:
+        return offsetof(regs_t, hl);
+    }
+    return offsetof(regs_t, sp);
+}
+
+// the CPU that native code runs on, with the cycle counter and the next
+// event deadline as offsets from its registers
+struct target_t
+{
+    CPU& cpu;
+    size_t cycles;
+    size_t next_event;
+};
+
+static void sync_hardware(CPU* cpu) { cpu->sync_hardware(); }
+static bool block_continues(CPU* cpu) { return cpu->block_continues(); }
+
+// CPU::hardware_tick(), only calling out when an event is due, which is
+// remembered in EBP
+static void emit_tick(Emitter& e, const target_t& t)
+{
+    e.rbx({0x48, 0x83}, 0, t.cycles); // ADD QWORD [cycles], 4
+    e.imm(4, 1);
+    e.rbx({0x48, 0x8B}, 0, t.cycles);     // MOV RAX, [cycles]
+    e.rbx({0x48, 0x3B}, 0, t.next_event); // CMP RAX, [next_event]
+    const size_t before_event = e.jb();
+    e.mov_rdi(&t.cpu);
+    e.call((const void*) sync_hardware);
+    e.bytes({0xBD, 0x01, 0x00, 0x00, 0x00}); // MOV EBP, 1
+    e.patch(before_event);
+}
+
+static void emit_readop(Emitter& e, const target_t& t)
+{
+    e.rbx({0x66, 0xFF}, 0, offsetof(regs_t, pc)); // INC WORD [pc]
+    emit_tick(e, t);
+}
+
+// F = Z from the x86 zero flag, shifted into place, in DL
+static void emit_zero_flag(Emitter& e)
+{
+    e.bytes({0x0F, 0x94, 0xC2}); // SETZ DL
+    e.bytes({0xC0, 0xE2, 0x07}); // SHL DL, 7
+}
+
+// emit instructions that only touch registers directly, returns false
+// when the instruction has to go through its handler instead
+static bool emit_native(Emitter& e, const target_t& t, const decoded_t& instr)
+{
+    const uint8_t op = instr.opcode;
+    const uint8_t dst = (op >> 3) & 0x7;
+    const uint8_t src = op & 0x7;
+    const size_t flags = offsetof(regs_t, flags);
+    const size_t accum = offsetof(regs_t, accum);
+
+    if (op == 0x00) return true; // NOP
+    if ((op & 0xC0) == 0x40 && dst != 0x6 && src != 0x6)
+    {
+        // LD D, D
+        e.rbx({0x8A}, 0, reg8(src)); // MOV AL, [src]
+        e.rbx({0x88}, 0, reg8(dst)); // MOV [dst], AL
+        return true;
+    }
+    if ((op & 0xC7) == 0x06 && dst != 0x6)
+    {
+        // LD D, imm8
+        emit_readop(e, t);
+        e.rbx({0xC6}, 0, reg8(dst));
+        e.imm(instr.imm[0], 1);
+        return true;
+    }
+    if ((op & 0xCF) == 0x01)
+    {
+        // LD R, imm16
+        e.rbx({0x66, 0x83}, 0, offsetof(regs_t, pc)); // ADD WORD [pc], 2
+        e.imm(2, 1);
+        emit_tick(e, t);
+        emit_tick(e, t);
+        e.rbx({0x66, 0xC7}, 0, reg16(op));
+        e.imm(instr.imm[0] | instr.imm[1] << 8, 2);
+        return true;
+    }
+    if ((op & 0xC7) == 0x03)
+    {
+        // INC R / DEC R
+        e.rbx({0x66, 0xFF}, (op & 0x8) ? 1 : 0, reg16(op));
+        emit_tick(e, t);
+        return true;
+    }
+    // with lazy flags, INC D / DEC D are left to the handler
+#ifndef GBC_LAZY_FLAGS
+    if ((op & 0xC6) == 0x04 && dst != 0x6)
+    {
+        // INC D / DEC D, leaving the carry and the unused flag bits alone
+        const bool dec = op & 0x1;
+        e.rbx({0x8A}, 0, reg8(dst));                   // MOV AL, [dst]
+        e.bytes({0xFE, uint8_t(dec ? 0xC8 : 0xC0)});   // INC/DEC AL
+        emit_zero_flag(e);
+        e.rbx({0x88}, 0, reg8(dst));                   // MOV [dst], AL
+        e.bytes({0x88, 0xC1});                         // MOV CL, AL
+        e.bytes({0x80, 0xE1, 0x0F});                   // AND CL, 0xF
+        e.bytes({0x80, 0xF9, uint8_t(dec ? 0xF : 0)}); // CMP CL, 0x0/0xF
+        e.bytes({0x0F, 0x94, 0xC1});                   // SETE CL
+        e.bytes({0xC0, 0xE1, 0x05});                   // SHL CL, 5
+        e.bytes({0x08, 0xCA});                         // OR DL, CL
+        if (dec) e.bytes({0x80, 0xCA, MASK_NEGATIVE}); // OR DL, N
+        e.rbx({0x8A}, 1, flags);                       // MOV CL, [flags]
+        e.bytes({0x80, 0xE1, 0x1F});                   // AND CL, ~(Z|N|H)
+        e.bytes({0x08, 0xCA});                         // OR DL, CL
+        e.rbx({0x88}, 2, flags);                       // MOV [flags], DL
+        return true;
+    }
+#endif
+    const bool alu_reg = (op & 0xC0) == 0x80 && src != 0x6;
+    const bool alu_imm = (op & 0xC7) == 0xC6;
+    if ((alu_reg || alu_imm) && dst >= AND && dst <= OR)
+    {
+        // AND/XOR/OR A, D or imm8
+        if (alu_imm) emit_readop(e, t);
+        e.rbx({0x8A}, 0, accum); // MOV AL, [accum]
+        const uint8_t x86op[] = {0x22, 0x32, 0x0A};
+        if (alu_reg) { e.rbx({x86op[dst - AND]}, 0, reg8(src)); }
+        else
+        {
+            e.bytes({uint8_t(x86op[dst - AND] + 2), instr.imm[0]}); // op AL, imm8
+        }
+        emit_zero_flag(e);
+        if (dst == AND) e.bytes({0x80, 0xCA, MASK_HALFCARRY}); // OR DL, H
+        e.rbx({0x88}, 0, accum);
+        e.rbx({0x88}, 2, flags);
+#ifdef GBC_LAZY_FLAGS
+        // all flags were overwritten
+        e.rbx({0xC6}, 0, offsetof(regs_t, lazy.op)); // MOV BYTE [lazy.op], LAZY_NONE
+        e.imm(regs_t::LAZY_NONE, 1);
+#endif
+        return true;
+    }
+    if ((alu_reg || alu_imm) && (dst == ADD || dst == SUB || dst == CP))
+    {
+        // ADD/SUB/CP A, D or imm8
+        if (alu_imm) emit_readop(e, t);
+        e.rbx({0x8A}, 0, accum); // MOV AL, [accum]
+        if (alu_reg) { e.rbx({0x8A}, 1, reg8(src)); } // MOV CL, [src]
+        else
+        {
+            e.bytes({0xB1, instr.imm[0]}); // MOV CL, imm8
+        }
+        const uint8_t x86op = (dst == ADD) ? 0x00 : 0x28;
+#ifdef GBC_LAZY_FLAGS
+        e.rbx({0xC6}, 0, offsetof(regs_t, lazy.op)); // MOV BYTE [lazy.op], LAZY_ADD/SUB
+        e.imm((dst == ADD) ? regs_t::LAZY_ADD : regs_t::LAZY_SUB, 1);
+        e.rbx({0x88}, 0, offsetof(regs_t, lazy.a));   // MOV [lazy.a], AL
+        e.rbx({0x88}, 1, offsetof(regs_t, lazy.b));   // MOV [lazy.b], CL
+        e.rbx({0xC6}, 0, offsetof(regs_t, lazy.cin)); // MOV BYTE [lazy.cin], 0
+        e.imm(0, 1);
+        e.bytes({x86op, 0xC8});                       // ADD/SUB AL, CL
+        e.rbx({0x88}, 0, offsetof(regs_t, lazy.res)); // MOV [lazy.res], AL
+#else
+        e.bytes({0x88, 0xC2});                                // MOV DL, AL
+        e.bytes({0x30, 0xCA});                                // XOR DL, CL
+        e.bytes({x86op, 0xC8});                               // ADD/SUB AL, CL
+        e.bytes({0x0F, 0x92, 0xC1});                          // SETC CL
+        e.bytes({0x0F, 0x94, 0xC4});                          // SETZ AH
+        e.bytes({0x30, 0xC2});                                // XOR DL, AL
+        e.bytes({0x80, 0xE2, 0x10});                          // AND DL, 0x10
+        e.bytes({0xD0, 0xE2});                                // SHL DL, 1
+        e.bytes({0xC0, 0xE1, 0x04});                          // SHL CL, 4
+        e.bytes({0x08, 0xCA});                                // OR DL, CL
+        e.bytes({0xC0, 0xE4, 0x07});                          // SHL AH, 7
+        e.bytes({0x08, 0xE2});                                // OR DL, AH
+        if (dst != ADD) e.bytes({0x80, 0xCA, MASK_NEGATIVE}); // OR DL, N
+        e.rbx({0x8A}, 1, flags);                              // MOV CL, [flags]
+        e.bytes({0x80, 0xE1, 0x0F});                          // AND CL, 0xF
+        e.bytes({0x08, 0xCA});                                // OR DL, CL
+        e.rbx({0x88}, 2, flags);                              // MOV [flags], DL
+#endif
+        if (dst != CP) e.rbx({0x88}, 0, accum); // MOV [accum], AL
+        return true;
+    }
+    return false;
+}
+
+static void emit_handler(Emitter& e, CPU& cpu, const decoded_t& instr, const uint8_t** operands)
+{
+    if (instr.length > 1) e.store_ptr(operands, instr.imm);
+    e.mov_rdi(&cpu);
+    e.bytes({0xBE}); // MOV ESI, opcode
+    e.imm(instr.opcode, 4);
+    e.call((const void*) instr.handler);
+    if (instr.length > 1) e.store_ptr(operands, nullptr);
+}
+
+bool JIT::compile(block_t& block)
+{
+    const auto* regs = (const uint8_t*) &m_cpu.registers();
+    const target_t t{m_cpu, size_t((const uint8_t*) &m_cpu.m_state.cycles_total - regs),
+                     size_t((const uint8_t*) &m_cpu.m_next_event - regs)};
+    Emitter e;
+    e.bytes({0x53, 0x55});             // PUSH RBX, PUSH RBP
+    e.bytes({0x48, 0x83, 0xEC, 0x08}); // SUB RSP, 8
+    e.bytes({0x48, 0xBB});             // MOV RBX, registers
+    e.imm((uintptr_t) regs, 8);
+    e.bytes({0x31, 0xED}); // XOR EBP, EBP
+
+    std::vector<size_t> exits;
+    for (size_t i = 0; i < block.code.size(); i++)
+    {
+        const auto& instr = block.code[i];
+        // opcode fetch
+        emit_readop(e, t);
+        const bool native = emit_native(e, t, instr);
+        if (!native) emit_handler(e, m_cpu, instr, &m_cpu.m_operands);
+        // same exit conditions as the block interpreter, which can only
+        // have changed when there was an event, unless breakpoints apply
+        if (i + 1 < block.code.size())
+        {
+            size_t no_event = 0;
+            if (native && !policy_t::breakpoints)
+            {
+                e.bytes({0x85, 0xED}); // TEST EBP, EBP
+                no_event = e.jz();
+            }
+            e.bytes({0x31, 0xED}); // XOR EBP, EBP
+            e.mov_rdi(&m_cpu);
+            e.call((const void*) block_continues);
+            e.bytes({0x84, 0xC0}); // TEST AL, AL
+            exits.push_back(e.jz());
+            if (no_event) e.patch(no_event);
+        }
+    }
+    for (const size_t pos : exits) e.patch(pos);
+    e.bytes({0x48, 0x83, 0xC4, 0x08}); // ADD RSP, 8
+    e.bytes({0x5D, 0x5B, 0xC3});       // POP RBP, POP RBX, RET
+
+    uint8_t* dst = this->allocate(e.code.size());
+    if (dst == nullptr) return false;
+    // code regions are never writable and executable at the same time
+    uint8_t* page = (uint8_t*) ((uintptr_t) dst & ~uintptr_t(4095));
+    const size_t len = dst + e.code.size() - page;
+    if (mprotect(page, len, PROT_READ | PROT_WRITE) != 0) return false;
+    std::memcpy(dst, e.code.data(), e.code.size());
+    if (mprotect(page, len, PROT_READ | PROT_EXEC) != 0) return false;
+    block.native = (native_t) dst;
+    return true;
+}
+
+uint8_t* JIT::allocate(const size_t bytes)
+{
+    if (m_regions.empty() || m_regions.back().used + bytes > REGION_SIZE)
+    {
+        if (bytes > REGION_SIZE) return nullptr;
+        void* base = mmap(nullptr, REGION_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1, 0);
+        if (base == MAP_FAILED) return nullptr;
+        m_regions.push_back({(uint8_t*) base, 0});
+    }
+    auto& region = m_regions.back();
+    uint8_t* result = region.base + region.used;
+    // keep native blocks 16-byte aligned
+    region.used += (bytes + 15) & ~size_t(15);
+    return result;
+}
+
+JIT::~JIT()
+{
+    for (auto& region : m_regions) { munmap(region.base, REGION_SIZE); }
+}
+} // namespace gbc
@@ -0,0 +1,45 @@
+#pragma once
+#include "blocks.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace gbc
+{
+class CPU;
+
+// x86-64 recompiler for hot ROM blocks: simple register instructions are
+// emitted natively, everything else calls the same specialized handlers as
+// the interpreter, and each instruction ticks the hardware exactly like the
+// interpreter does, so that the two are bit-exact. Ticks only call out to
+// the hardware when an event is due.
+class JIT
+{
+public:
+    static constexpr uint32_t HOT_THRESHOLD = 32;
+
+    JIT(CPU& cpu) : m_cpu(cpu) {}
+    ~JIT();
+
+    // count one execution, and return true when the block has native code
+    bool hot(block_t&);
+
+private:
+    bool compile(block_t&);
+    uint8_t* allocate(size_t bytes);
+
+    CPU& m_cpu;
+    struct region_t
+    {
+        uint8_t* base;
+        size_t used;
+    };
+    std::vector<region_t> m_regions;
+};
+
+inline bool JIT::hot(block_t& block)
+{
+    if (LIKELY(block.native != nullptr)) return true;
+    if (block.rom && ++block.hits == HOT_THRESHOLD) return this->compile(block);
+    return false;
+}
+} // namespace gbc
@@ -8,6 +8,9 @@ Machine::Machine(const std::vector<uint8_t>& rom, bool init)
     // set CGB mode when ROM supports it
     const uint8_t cgb = memory.read8(0x143);
     this->m_cgb_mode = (cgb & 0x80) && ENABLE_GBC;
+    this->io.set_cgb_mode(m_cgb_mode);
+    this->gpu.set_cgb_mode(m_cgb_mode);
+    this->memory.remap();
     // reset CPU now that we know the machine type
     if (init) this->cpu.reset();
 }
@@ -18,6 +21,7 @@ void Machine::reset()
     memory.reset();
     io.reset();
     gpu.reset();
+    memory.remap();
 }
 void Machine::stop() noexcept { this->m_running = false; }
 
@@ -59,9 +63,13 @@ void Machine::restore_state(const std::vector<uint8_t>& data)
     offset += io.restore_state(data, offset);
     offset += gpu.restore_state(data, offset);
     offset += apu.restore_state(data, offset);
+    memory.remap();
 }
-void Machine::serialize_state(std::vector<uint8_t>& result) const
+void Machine::serialize_state(std::vector<uint8_t>& result)
 {
+    // catching up does not change the observable state
+    cpu.sync_hardware();
+    io.sync_timer();
     cpu.serialize_state(result);
     memory.serialize_state(result);
     io.serialize_state(result);
@@ -55,7 +55,9 @@ public:
 
     // serialization (state-keeping)
     void restore_state(const std::vector<uint8_t>&);
-    void serialize_state(std::vector<uint8_t>&) const;
+    // catches the hardware and the timer up to the CPU before saving,
+    // which is why it can't be const
+    void serialize_state(std::vector<uint8_t>&);
 
     /// debugging aids ///
     bool verbose_instructions = false;
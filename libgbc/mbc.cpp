@@ -9,7 +9,11 @@
 
 namespace gbc
 {
-MBC::MBC(Memory& m, const std::vector<uint8_t>& rom) : m_memory(m), m_rom(rom) {}
+// work RAM and cartridge RAM start out cleared, and save states never
+// contain uninitialized bytes, padding included
+MBC::MBC(Memory& m, const std::vector<uint8_t>& rom)
+    : m_memory(m), m_rom(rom), m_state(), m_ram()
+{}
 
 void MBC::init()
 {
@@ -135,6 +139,7 @@ void MBC::write(uint16_t addr, uint8_t value)
             this->m_state.ram_enabled = value != 0;
         else
             this->m_state.ram_enabled = ((value & 0xF) == 0xA);
+        this->m_memory.remap_extram();
         if (UNLIKELY(verbose_banking()))
         { printf("* External RAM enabled: %d\n", this->m_state.ram_enabled); }
         return;
@@ -209,6 +214,8 @@ void MBC::set_rombank(int reg)
         return;
     }
     this->m_state.rom_bank_offset = offset;
+    this->m_memory.remap_rom();
+    this->m_memory.machine().cpu.blocks().bank_switched();
 }
 void MBC::set_rambank(int reg)
 {
@@ -224,6 +231,7 @@ void MBC::set_rambank(int reg)
                m_state.ram_bank_size);
     }
     this->m_state.ram_bank_offset = offset;
+    this->m_memory.remap_extram();
 }
 void MBC::set_wrambank(int reg)
 {
@@ -237,6 +245,8 @@ void MBC::set_wrambank(int reg)
         return;
     }
     this->m_state.wram_offset = offset;
+    this->m_memory.remap_wram();
+    this->m_memory.machine().cpu.blocks().bank_switched();
 }
 void MBC::set_mode(int mode)
 {
@@ -254,7 +264,10 @@ void MBC::set_mode(int mode)
     }
 }
 
-bool MBC::verbose_banking() const noexcept { return m_memory.machine().verbose_banking; }
+bool MBC::verbose_banking() const noexcept
+{
+    return policy_t::verbose && m_memory.machine().verbose_banking;
+}
 
 // serialization
 int MBC::restore_state(const std::vector<uint8_t>& data, int off)
@@ -1,6 +1,7 @@
 #pragma once
 #include <array>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -23,6 +24,7 @@ public:
 
     const auto& rom() const noexcept { return m_rom; }
     uint32_t rombank_offset() const noexcept { return m_state.rom_bank_offset; }
+    uint16_t wrambank_offset() const noexcept { return m_state.wram_offset; }
 
     bool ram_enabled() const noexcept { return m_state.ram_enabled; }
     size_t rombank_size() const noexcept { return 0x4000; }
@@ -17,8 +17,8 @@ inline void MBC::write_MBC3(uint16_t addr, uint8_t value)
         return;
     case 0x4000:
     case 0x5000:
-        this->set_rambank(value & 0x7);
         this->m_state.rtc_enabled = (value & 0x80);
+        this->set_rambank(value & 0x7);
         return;
     case 0x6000:
     case 0x7000:
@@ -24,14 +24,10 @@ void Memory::disable_bootrom() { m_state.bootrom_enabled = false; }
 
 void Memory::set_wram_bank(uint8_t bank) { this->m_mbc.set_wrambank(bank); }
 
-uint8_t Memory::read8(uint16_t address)
+uint8_t Memory::read_slow(uint16_t address)
 {
-    if (UNLIKELY(!m_read_breakpoints.empty() && !m_is_busy))
-    {
-        this->m_is_busy = true;
-        for (auto& func : m_read_breakpoints) { func(*this, address, 0x0); }
-        this->m_is_busy = false;
-    }
+    if (UNLIKELY(m_watched[address >> 8] & (1 << READ)))
+        this->check_watchpoints(READ, address, 0x0);
     switch (address & 0xF000)
     {
     case 0x0000:
@@ -87,14 +83,10 @@ uint8_t Memory::read8(uint16_t address)
     return 0xff;
 }
 
-void Memory::write8(uint16_t address, uint8_t value)
+void Memory::write_slow(uint16_t address, uint8_t value)
 {
-    if (UNLIKELY(!m_write_breakpoints.empty() && !m_is_busy))
-    {
-        this->m_is_busy = true;
-        for (auto& func : m_write_breakpoints) { func(*this, address, value); }
-        this->m_is_busy = false;
-    }
+    if (UNLIKELY(m_watched[address >> 8] & (1 << WRITE)))
+        this->check_watchpoints(WRITE, address, value);
     switch (address & 0xF000)
     {
     case 0x0000:
@@ -111,8 +103,9 @@ void Memory::write8(uint16_t address, uint8_t value)
     case 0x9000:
         if (machine().gpu.get_mode() != 3)
         {
-            const uint16_t offset = machine().gpu.video_offset();
-            m_state.video_ram.at(offset + address - VideoRAM.first) = value;
+            const uint16_t offset = machine().gpu.video_offset() + address - VideoRAM.first;
+            m_state.video_ram.at(offset) = value;
+            machine().gpu.vram_written(offset, value);
         }
         return;
     case 0xA000:
@@ -122,19 +115,23 @@ void Memory::write8(uint16_t address, uint8_t value)
     case 0xC000:
     case 0xD000:
         m_mbc.write(address, value);
+        this->wram_written(address);
         return;
     case 0xE000: // echo RAM
         m_mbc.write(address, value);
+        this->wram_written(address);
         return;
     case 0xF000:
         if (this->is_within(address, EchoRAM))
         {
             m_mbc.write(address, value);
+            this->wram_written(address);
             return;
         }
         else if (this->is_within(address, OAM_RAM))
         {
             this->m_state.oam_ram.at(address - OAM_RAM.first) = value;
+            machine().gpu.oam_written(address - OAM_RAM.first, value);
             return;
         }
         else if (this->is_within(address, IO_Ports))
@@ -145,6 +142,7 @@ void Memory::write8(uint16_t address, uint8_t value)
         else if (this->is_within(address, ZRAM))
         {
             this->m_state.zram.at(address - ZRAM.first) = value;
+            machine().cpu.blocks().hram_written(address);
             return;
         }
         else if (address == InterruptEn)
@@ -156,6 +154,130 @@ void Memory::write8(uint16_t address, uint8_t value)
     printf(">>> Invalid memory write at 0x%04x, value 0x%x\n", address, value);
 }
 
+void Memory::remap()
+{
+    this->remap_rom();
+    this->remap_extram();
+    this->remap_wram();
+    this->remap_vram();
+}
+void Memory::watch(amode_t mode, uint16_t first, uint16_t last, access_t func, int bank)
+{
+    this->m_watchpoints.push_back({mode, first, last, bank, func});
+    for (uint32_t page = first >> 8; page <= (last >> 8u); page++) { m_watched[page] |= 1 << mode; }
+    if (mode == READ) this->m_read_watchpoints++;
+    this->remap();
+}
+void Memory::clear_watchpoints()
+{
+    this->m_watchpoints.clear();
+    this->m_watched = {};
+    this->m_read_watchpoints = 0;
+    this->remap();
+}
+void Memory::check_watchpoints(const amode_t mode, const uint16_t address, const uint8_t value)
+{
+    // watchpoints may access memory themselves
+    if (m_is_busy) return;
+    this->m_is_busy = true;
+    const int bank = this->current_bank(address);
+    for (auto& wp : m_watchpoints)
+    {
+        if (wp.mode == mode && address >= wp.first && address <= wp.last &&
+            (wp.bank == ANY_BANK || wp.bank == bank))
+        { wp.func(*this, address, value); }
+    }
+    this->m_is_busy = false;
+}
+int Memory::current_bank(const uint16_t address) const noexcept
+{
+    switch (address & 0xF000)
+    {
+    case 0x4000:
+    case 0x5000:
+    case 0x6000:
+    case 0x7000:
+        return m_mbc.rombank_offset() / m_mbc.rombank_size();
+    case 0x8000:
+    case 0x9000:
+        return machine().gpu.video_offset() / 0x2000;
+    case 0xA000:
+    case 0xB000:
+        return m_mbc.m_state.ram_bank_offset / m_mbc.rambank_size();
+    case 0xD000:
+        return m_mbc.wrambank_offset() / m_mbc.wrambank_size();
+    case 0xF000:
+        if (is_within(address, EchoRAM)) return m_mbc.wrambank_offset() / m_mbc.wrambank_size();
+    }
+    return 0;
+}
+
+void Memory::remap_rom()
+{
+    machine().cpu.invalidate_fetch();
+    // ROM is never writable, writes go to the MBC registers
+    for (uint32_t page = 0x00; page < 0x80; page++)
+    {
+        uint32_t offset = page << 8;
+        if (page >= 0x40) offset = m_mbc.rombank_offset() + offset - 0x4000;
+        this->map_page(page, (offset + 0x100 <= m_rom.size()) ? &m_rom[offset] : nullptr, nullptr);
+    }
+}
+void Memory::remap_extram()
+{
+    machine().cpu.invalidate_fetch();
+    const auto& mbc = m_mbc.m_state;
+    const bool direct = mbc.ram_enabled && !mbc.rtc_enabled;
+    for (uint32_t page = 0xA0; page < 0xC0; page++)
+    {
+        const uint32_t offset = mbc.ram_bank_offset | ((page - 0xA0) << 8);
+        // small 2kb RAM banks read 0xff past the end
+        uint8_t* ptr = nullptr;
+        if (direct && offset + 0x100 <= mbc.ram_bank_size) ptr = &m_mbc.m_ram[offset];
+        this->map_page(page, ptr, ptr);
+    }
+}
+void Memory::remap_wram()
+{
+    machine().cpu.invalidate_fetch();
+    const auto& blocks = machine().cpu.blocks();
+    for (uint32_t page = 0xC0; page < 0xFE; page++)
+    {
+        // echo RAM uses the same banking as Work RAM
+        const uint32_t addr = ((page < 0xE0) ? page : page - 0x20) << 8;
+        uint32_t offset = addr & 0xFFF;
+        if (addr & 0x1000) offset += m_mbc.wrambank_offset();
+        uint8_t* ptr = &m_mbc.m_state.wram[offset];
+        // pages with cached code have to invalidate it when written to
+        this->map_page(page, ptr, blocks.wram_page_cached(offset) ? nullptr : ptr);
+    }
+}
+void Memory::remap_vram()
+{
+    machine().cpu.invalidate_fetch();
+    // Video RAM is inaccessible while the PPU is drawing
+    uint8_t* vram = nullptr;
+    if (machine().gpu.get_mode() != 3)
+        vram = &m_state.video_ram[machine().gpu.video_offset()];
+    for (uint32_t page = 0x80; page < 0xA0; page++)
+    {
+        uint8_t* ptr = (vram != nullptr) ? vram + ((page - 0x80) << 8) : nullptr;
+        // writes to tile data have to invalidate the decoded tiles, and the
+        // render thread needs to see every write
+        const bool logged = page < 0x98 || GPU::THREADED_RENDER;
+        this->map_page(page, ptr, logged ? nullptr : ptr);
+    }
+}
+
+// let the CPU know when cached code may have been overwritten
+void Memory::wram_written(const uint16_t address)
+{
+    // echo RAM uses the same banking as Work RAM
+    uint16_t offset = address & 0xFFF;
+    if (address & 0x1000) offset += m_mbc.wrambank_offset();
+    machine().cpu.blocks().wram_written(offset);
+}
+
 void Memory::do_switch_speed()
 {
     auto& reg = machine().io.reg(IO::REG_KEY1);
@@ -213,6 +335,9 @@ int Memory::restore_state(const std::vector<uint8_t>& data, int off)
 {
     this->m_state = *(state_t*) &data.at(off);
     off += sizeof(state_t);
+    // cached RAM code and decoded tiles are no longer valid
+    machine().cpu.blocks().flush_ram();
+    machine().gpu.reload_video_memory();
     // also restore MBC
     return sizeof(state_t) + this->m_mbc.restore_state(data, off);
 }
@@ -34,10 +34,20 @@ public:
     uint16_t read16(uint16_t address);
     void write16(uint16_t address, uint16_t value);
 
+    // rebuild the page tables after bank switches and PPU mode changes
+    void remap();
+    void remap_rom();
+    void remap_extram();
+    void remap_wram();
+    void remap_vram();
+    // the page instructions can be fetched from directly, if any
+    const uint8_t* fetch_page(uint16_t address) const noexcept;
+
     uint8_t* oam_ram_ptr() noexcept { return m_state.oam_ram.data(); }
     const uint8_t* oam_ram_ptr() const noexcept { return m_state.oam_ram.data(); }
     uint8_t* video_ram_ptr() noexcept { return m_state.video_ram.data(); }
     const uint8_t* video_ram_ptr() const noexcept { return m_state.video_ram.data(); }
+    const MBC& mbc() const noexcept { return m_mbc; }
 
     static constexpr uint16_t range_size(range_t range) { return range.second - range.first; }
 
@@ -63,7 +73,14 @@ public:
         WRITE
     };
     using access_t = delegate<void(Memory&, uint16_t, uint8_t)>;
-    void breakpoint(amode_t, access_t);
+    // call func before any access to [first, last], optionally only while the
+    // given ROM, Video RAM, external RAM or Work RAM bank is mapped there
+    void watch(amode_t, uint16_t first, uint16_t last, access_t func, int bank = ANY_BANK);
+    void breakpoint(amode_t mode, access_t func) { this->watch(mode, 0x0000, 0xFFFF, func); }
+    void clear_watchpoints();
+    bool has_read_watchpoints() const noexcept { return m_read_watchpoints != 0; }
+    // the bank currently mapped at address, 0 for unbanked memory
+    int current_bank(uint16_t address) const noexcept;
 
     inline static bool is_within(uint16_t addr, const range_t& range)
     {
@@ -71,6 +88,12 @@ public:
     }
 
 private:
+    uint8_t read_slow(uint16_t address);
+    void write_slow(uint16_t address, uint8_t value);
+    void map_page(uint32_t page, const uint8_t* read, uint8_t* write) noexcept;
+    void check_watchpoints(amode_t, uint16_t address, uint8_t value);
+    void wram_written(uint16_t address);
+
     Machine& m_machine;
     const std::vector<uint8_t>& m_rom;
     MBC m_mbc;
@@ -83,16 +106,46 @@ private:
         int8_t speed_factor = 1;
     } m_state;
     bool m_is_busy = false;
-    std::vector<access_t> m_read_breakpoints;
-    std::vector<access_t> m_write_breakpoints;
+    // one entry per 256-byte page, pointing straight at the memory behind
+    // it, or nullptr when the access has to take the slow path
+    std::array<const uint8_t*, 256> m_read_pages = {};
+    std::array<uint8_t*, 256> m_write_pages = {};
+    // watched pages are never mapped, so only accesses to them are checked
+    struct watchpoint_t
+    {
+        amode_t mode;
+        uint16_t first;
+        uint16_t last;
+        int bank;
+        access_t func;
+    };
+    std::vector<watchpoint_t> m_watchpoints;
+    std::array<uint8_t, 256> m_watched = {}; // 1 << amode_t per page
+    int m_read_watchpoints = 0;
 };
 
-inline void Memory::breakpoint(amode_t mode, access_t func)
+inline const uint8_t* Memory::fetch_page(const uint16_t address) const noexcept
+{
+    return m_read_pages[address >> 8];
+}
+inline void Memory::map_page(const uint32_t page, const uint8_t* read, uint8_t* write) noexcept
+{
+    m_read_pages[page] = (m_watched[page] & (1 << READ)) ? nullptr : read;
+    m_write_pages[page] = (m_watched[page] & (1 << WRITE)) ? nullptr : write;
+}
+inline uint8_t Memory::read8(const uint16_t address)
+{
+    const uint8_t* page = m_read_pages[address >> 8];
+    if (LIKELY(page != nullptr)) return page[address & 0xFF];
+    return this->read_slow(address);
+}
+inline void Memory::write8(const uint16_t address, const uint8_t value)
 {
-    if (mode == READ)
-        m_read_breakpoints.push_back(func);
-    else if (mode == WRITE)
-        m_write_breakpoints.push_back(func);
+    uint8_t* page = m_write_pages[address >> 8];
+    if (LIKELY(page != nullptr))
+        page[address & 0xFF] = value;
+    else
+        this->write_slow(address, value);
 }
 
 inline uint16_t Memory::read16(uint16_t address)
@@ -54,6 +54,89 @@ struct regs_t
     uint16_t sp;
     uint16_t pc;
 
+#ifdef GBC_LAZY_FLAGS
+    // the last ADD/SUB/INC/DEC, whose flags are only evaluated when read
+    enum lazy_op_t : uint8_t
+    {
+        LAZY_NONE = 0,
+        LAZY_ADD,
+        LAZY_SUB,
+        LAZY_INC,
+        LAZY_DEC
+    };
+    struct lazy_t
+    {
+        uint8_t op = LAZY_NONE;
+        uint8_t a = 0;
+        uint8_t b = 0;
+        uint8_t cin = 0; // carry in, or the unchanged carry for INC/DEC
+        uint8_t res = 0;
+    } lazy;
+#endif
+
+    // evaluate the pending flags, if any, into the flags register
+    void materialize() noexcept
+    {
+#ifdef GBC_LAZY_FLAGS
+        if (LIKELY(lazy.op == LAZY_NONE)) return;
+        uint8_t f = (lazy.res == 0) ? MASK_ZERO : 0;
+        switch (lazy.op)
+        {
+        case LAZY_ADD:
+            if ((lazy.a & 0xf) + (lazy.b & 0xf) + lazy.cin > 0xf) f |= MASK_HALFCARRY;
+            if (lazy.a + lazy.b + lazy.cin > 0xFF) f |= MASK_CARRY;
+            break;
+        case LAZY_SUB:
+            f |= MASK_NEGATIVE;
+            if ((lazy.a & 0xf) < (lazy.b & 0xf) + lazy.cin) f |= MASK_HALFCARRY;
+            if (lazy.a < lazy.b + lazy.cin) f |= MASK_CARRY;
+            break;
+        case LAZY_INC:
+            if ((lazy.res & 0xF) == 0x0) f |= MASK_HALFCARRY;
+            if (lazy.cin) f |= MASK_CARRY;
+            break;
+        case LAZY_DEC:
+            f |= MASK_NEGATIVE;
+            if ((lazy.res & 0xF) == 0xF) f |= MASK_HALFCARRY;
+            if (lazy.cin) f |= MASK_CARRY;
+            break;
+        }
+        this->flags = (flags & 0x0F) | f;
+        this->lazy.op = LAZY_NONE;
+#endif
+    }
+    // flags that are read, or only partially modified
+    uint8_t& get_flags() noexcept
+    {
+        this->materialize();
+        return flags;
+    }
+    // flags that are about to be completely overwritten
+    uint8_t& overwrite_flags() noexcept
+    {
+#ifdef GBC_LAZY_FLAGS
+        this->lazy.op = LAZY_NONE;
+#endif
+        return flags;
+    }
+    // single flags, without materializing
+    bool zero() const noexcept
+    {
+#ifdef GBC_LAZY_FLAGS
+        if (lazy.op != LAZY_NONE) return lazy.res == 0;
+#endif
+        return flags & MASK_ZERO;
+    }
+    uint8_t carry() const noexcept
+    {
+#ifdef GBC_LAZY_FLAGS
+        if (lazy.op == LAZY_ADD) return lazy.a + lazy.b + lazy.cin > 0xFF;
+        if (lazy.op == LAZY_SUB) return lazy.a < lazy.b + lazy.cin;
+        if (lazy.op != LAZY_NONE) return lazy.cin;
+#endif
+        return (flags & MASK_CARRY) ? 1 : 0;
+    }
+
     inline uint16_t& getreg(const uint8_t bf, const bool use_sp)
     {
         switch (bf & 0x3)
@@ -65,45 +148,61 @@ struct regs_t
         case 2:
             return hl;
         case 3:
-            return (use_sp) ? sp : af;
+            if (use_sp) return sp;
+            this->materialize();
+            return af;
         }
         __builtin_unreachable();
     }
     uint16_t& getreg_sp(const uint8_t opcode) { return getreg((opcode >> 4) & 0x3, true); }
     uint16_t& getreg_af(const uint8_t opcode) { return getreg((opcode >> 4) & 0x3, false); }
 
-    uint8_t& getdest(const uint8_t bf)
+    // compile-time register selection for opcode-specialized handlers
+    template <uint8_t OP>
+    uint16_t& getreg_sp() noexcept
     {
-        switch (bf & 0x7)
+        constexpr uint8_t idx = (OP >> 4) & 0x3;
+        if constexpr (idx == 0) return bc;
+        else if constexpr (idx == 1) return de;
+        else if constexpr (idx == 2) return hl;
+        else return sp;
+    }
+    template <uint8_t OP>
+    uint16_t& getreg_af() noexcept
+    {
+        constexpr uint8_t idx = (OP >> 4) & 0x3;
+        if constexpr (idx == 0) return bc;
+        else if constexpr (idx == 1) return de;
+        else if constexpr (idx == 2) return hl;
+        else
         {
-        case 0:
-            return b;
-        case 1:
-            return c;
-        case 2:
-            return d;
-        case 3:
-            return e;
-        case 4:
-            return h;
-        case 5:
-            return l;
-        case 6:
-            throw std::runtime_error("getdest: (HL) not accessible here");
-        case 7:
-            return accum;
+            this->materialize();
+            return af;
         }
-        __builtin_unreachable();
     }
 
-    bool compare_flags(const uint8_t opcode) noexcept
+    template <uint8_t BF>
+    uint8_t& getdest() noexcept
     {
-        const uint8_t idx = (opcode >> 3) & 0x3;
-        if (idx == 0) return (flags & MASK_ZERO) == 0;  // not zero
-        if (idx == 1) return (flags & MASK_ZERO);       // zero
-        if (idx == 2) return (flags & MASK_CARRY) == 0; // not carry
-        if (idx == 3) return (flags & MASK_CARRY);      // carry
-        __builtin_unreachable();
+        constexpr uint8_t idx = BF & 0x7;
+        static_assert(idx != 6, "getdest: (HL) not accessible here");
+        if constexpr (idx == 0) return b;
+        else if constexpr (idx == 1) return c;
+        else if constexpr (idx == 2) return d;
+        else if constexpr (idx == 3) return e;
+        else if constexpr (idx == 4) return h;
+        else if constexpr (idx == 5) return l;
+        else return accum;
+    }
+
+    template <uint8_t OP>
+    bool compare_flags() const noexcept
+    {
+        constexpr uint8_t idx = (OP >> 3) & 0x3;
+        if constexpr (idx == 0) return !zero();       // not zero
+        else if constexpr (idx == 1) return zero();   // zero
+        else if constexpr (idx == 2) return !carry(); // not carry
+        else return carry();                          // carry
     }
 
     inline static bool half_carry(const uint8_t reg, const uint8_t val)
@@ -115,74 +214,110 @@ struct regs_t
         return (reg & 0xf) < (val & 0xf);
     }
 
-    void alu(uint8_t op, uint8_t value) noexcept
+    template <uint8_t OP>
+    void alu(uint8_t value) noexcept
     {
         auto& reg = this->accum;
-        switch (op & 0x7)
-        {
-        case 0x0:
+        if constexpr ((OP & 0x7) == 0x0)
         { // ADD
+#ifdef GBC_LAZY_FLAGS
+            this->lazy = {LAZY_ADD, reg, value, 0, uint8_t(reg + value)};
+            reg = lazy.res;
+#else
             const uint16_t calc = reg + value;
             setflag(false, flags, MASK_NEGATIVE);
             setflag(half_carry(reg, value), flags, MASK_HALFCARRY);
             setflag(calc & 0x100, flags, MASK_CARRY);
             reg += value;
             setflag(reg == 0, flags, MASK_ZERO);
+#endif
         }
-            return;
-        case 0x1:
+        else if constexpr ((OP & 0x7) == 0x1)
         { // ADC
-            const int carry = (flags & MASK_CARRY) ? 1 : 0;
+            const int carry = this->carry();
+#ifdef GBC_LAZY_FLAGS
+            this->lazy = {LAZY_ADD, reg, value, uint8_t(carry), uint8_t(reg + value + carry)};
+            reg = lazy.res;
+#else
             setflag(false, flags, MASK_NEGATIVE);
             setflag((reg & 0xf) + (value & 0xf) + carry > 0xf, flags, MASK_HALFCARRY); // annoying!
             setflag(((int) reg + value + carry) > 0xFF, flags, MASK_CARRY);
             reg += value + carry;
             setflag(reg == 0, flags, MASK_ZERO);
+#endif
         }
-            return;
-        case 0x2: // SUB
+        else if constexpr ((OP & 0x7) == 0x2)
+        { // SUB
+#ifdef GBC_LAZY_FLAGS
+            this->lazy = {LAZY_SUB, reg, value, 0, uint8_t(reg - value)};
+            reg = lazy.res;
+#else
             setflag(true, flags, MASK_NEGATIVE);
             setflag(half_borrow(reg, value), flags, MASK_HALFCARRY);
             setflag(reg < value, flags, MASK_CARRY);
             setflag(reg == value, flags, MASK_ZERO);
             reg -= value;
-            return;
-        case 0x3:
+#endif
+        }
+        else if constexpr ((OP & 0x7) == 0x3)
         { // SBC
-            const int carry = (flags & MASK_CARRY) ? 1 : 0;
+            const int carry = this->carry();
+#ifdef GBC_LAZY_FLAGS
+            this->lazy = {LAZY_SUB, reg, value, uint8_t(carry), uint8_t(reg - value - carry)};
+            reg = lazy.res;
+#else
             flags = MASK_NEGATIVE;
             setflag(((reg & 0xf) - (value & 0xf) - carry) < 0, flags, MASK_HALFCARRY);
             setflag(reg < value + carry, flags, MASK_CARRY);
             reg -= value + carry;
             setflag(reg == 0, flags, MASK_ZERO);
+#endif
         }
-            return;
-        case 0x4: // AND
+        else if constexpr ((OP & 0x7) == 0x4)
+        { // AND
             reg &= value;
-            flags = MASK_HALFCARRY;
-            setflag(reg == 0, flags, MASK_ZERO);
-            return;
-        case 0x5: // XOR
+            overwrite_flags() = MASK_HALFCARRY | (reg == 0 ? MASK_ZERO : 0);
+        }
+        else if constexpr ((OP & 0x7) == 0x5)
+        { // XOR
             reg ^= value;
-            flags = 0;
-            setflag(reg == 0, flags, MASK_ZERO);
-            return;
-        case 0x6: // OR
+            overwrite_flags() = (reg == 0) ? MASK_ZERO : 0;
+        }
+        else if constexpr ((OP & 0x7) == 0x6)
+        { // OR
             reg |= value;
-            flags = 0;
-            setflag(reg == 0, flags, MASK_ZERO);
-            return;
-        case 0x7: // CP
+            overwrite_flags() = (reg == 0) ? MASK_ZERO : 0;
+        }
+        else
+        { // CP
+#ifdef GBC_LAZY_FLAGS
+            this->lazy = {LAZY_SUB, reg, value, 0, uint8_t(reg - value)};
+#else
             const uint8_t tmp = reg - value;
             flags |= MASK_NEGATIVE;
             setflag(tmp == 0, flags, MASK_ZERO);
             setflag(reg < value, flags, MASK_CARRY);
             setflag(half_borrow(reg, value), flags, MASK_HALFCARRY);
-            // printf("CP %02x vs %02x (F => %02x)\n", reg, value, flags);
-            return;
+#endif
         }
     } // alu()
 
+    // flags of 8-bit INC/DEC, which leave the carry alone
+    template <bool DEC>
+    void incdec_flags(const uint8_t value) noexcept
+    {
+#ifdef GBC_LAZY_FLAGS
+        this->lazy = {DEC ? LAZY_DEC : LAZY_INC, 0, 0, this->carry(), value};
+#else
+        setflag(DEC, flags, MASK_NEGATIVE);
+        setflag(value == 0, flags, MASK_ZERO);
+        if constexpr (!DEC)
+            setflag((value & 0xF) == 0x0, flags, MASK_HALFCARRY);
+        else
+            setflag((value & 0xF) == 0xF, flags, MASK_HALFCARRY);
+#endif
+    }
+
     std::string to_string() const
     {
         char buffer[512];
@@ -0,0 +1,40 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace gbc
+{
+// lock-free queue from one producer thread to one consumer thread
+template <typename T, size_t N>
+class Ring
+{
+    static_assert((N & (N - 1)) == 0, "The ring size must be a power of two");
+
+public:
+    bool push(const T& item) noexcept
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == N) return false;
+        m_items[head % N] = item;
+        // sequentially consistent, so that a consumer that just went to
+        // sleep either sees the item, or is seen to be sleeping
+        m_head.store(head + 1);
+        return true;
+    }
+    bool pop(T& item) noexcept
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (m_head.load() == tail) return false;
+        item = m_items[tail % N];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    bool empty() const noexcept { return m_head.load() == m_tail.load(); }
+
+private:
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+    std::array<T, N> m_items;
+};
+} // namespace gbc
@@ -1,11 +1,13 @@
 #pragma once
 #include "memory.hpp"
+#include "tilecache.hpp"
 
 namespace gbc
 {
 struct sprite_config_t
 {
     const uint8_t* patterns;
+    TileCache* tiles;
     uint8_t palette[2];
     int scan_x;
     int scan_y;
@@ -32,6 +34,10 @@ public:
     int cgb_pal() const noexcept { return attr & 0x7; }
 
     uint8_t pixel(const sprite_config_t&) const;
+    // the 8 pixels of this sprite on the scanline, from left to right
+    const uint8_t* row(const sprite_config_t&) const;
+    template <bool CGB>
+    const uint8_t* row(const sprite_config_t&) const;
 
     int start_x() const noexcept { return xpos - 8; }
     int start_y() const noexcept { return ypos - 16; }
@@ -50,20 +56,22 @@ private:
 
 inline uint8_t Sprite::pixel(const sprite_config_t& config) const
 {
-    int tx = config.scan_x - start_x();
-    int ty = config.scan_y - start_y();
+    const int tx = config.scan_x - start_x();
     if (tx < 0 || tx >= SPRITE_W) return 0;
-    if (this->flipx()) tx = SPRITE_W - 1 - tx;
+    return this->row(config)[tx];
+}
+inline const uint8_t* Sprite::row(const sprite_config_t& config) const
+{
+    return config.is_cgb ? this->row<true>(config) : this->row<false>(config);
+}
+template <bool CGB>
+inline const uint8_t* Sprite::row(const sprite_config_t& config) const
+{
+    int ty = config.scan_y - start_y();
     if (this->flipy()) ty = config.height - 1 - ty;
-
-    int offset = this->pattern * 16 + ty * 2;
-    if (config.is_cgb) offset += cgb_bank() * 0x2000;
-    uint8_t c0 = config.patterns[offset];
-    uint8_t c1 = config.patterns[offset + 1];
-    // return combined 4-bits, right to left
-    const int bit = 7 - tx;
-    const int v0 = (c0 >> bit) & 0x1;
-    const int v1 = (c1 >> bit) & 0x1;
-    return v0 | (v1 << 1);
+    // 8x16 sprites continue into the next tile
+    int tile = this->pattern + ty / 8;
+    if (CGB) tile += cgb_bank() * TileCache::BANK_TILES;
+    return config.tiles->row(config.patterns, tile, ty & 7, this->flipx());
 }
 } // namespace gbc
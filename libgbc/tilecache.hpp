@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+namespace gbc
+{
+// the tiles of both Video RAM banks decoded into one palette index per
+// pixel, with each row also stored horizontally flipped, and decoded again
+// only after their Video RAM has been written to
+class TileCache
+{
+public:
+    static constexpr int BANK_TILES = 384;
+    static constexpr int TILES = 2 * BANK_TILES;
+
+    TileCache() noexcept { this->invalidate_all(); }
+
+    // offset is relative to the start of Video RAM bank 0
+    void invalidate(uint16_t offset) noexcept;
+    void invalidate_all() noexcept { m_dirty.fill(true); }
+    // the 8 pixels of row ty in tile, from left to right
+    const uint8_t* row(const uint8_t* vram, int tile, int ty, bool flipx);
+
+private:
+    void decode(const uint8_t* vram, int tile);
+
+    std::array<std::array<std::array<uint8_t, 64>, 2>, TILES> m_pixels;
+    std::array<bool, TILES> m_dirty;
+};
+
+inline void TileCache::invalidate(const uint16_t offset) noexcept
+{
+    // only the first 0x1800 bytes of each bank hold tiles
+    const uint16_t bank_offset = offset & 0x1FFF;
+    if (bank_offset < 0x1800) m_dirty[(offset / 0x2000) * BANK_TILES + bank_offset / 16] = true;
+}
+inline const uint8_t* TileCache::row(const uint8_t* vram, const int tile, const int ty,
+                                     const bool flipx)
+{
+    if (m_dirty[tile]) this->decode(vram, tile);
+    return &m_pixels[tile][flipx][ty * 8];
+}
+inline void TileCache::decode(const uint8_t* vram, const int tile)
+{
+    const uint8_t* data = &vram[(tile / BANK_TILES) * 0x2000 + (tile % BANK_TILES) * 16];
+    for (int y = 0; y < 8; y++)
+    {
+        const uint8_t c0 = data[y * 2];
+        const uint8_t c1 = data[y * 2 + 1];
+        for (int x = 0; x < 8; x++)
+        {
+            const int bit = 7 - x;
+            const uint8_t idx = ((c0 >> bit) & 0x1) | (((c1 >> bit) & 0x1) << 1);
+            m_pixels[tile][0][y * 8 + x] = idx;
+            m_pixels[tile][1][y * 8 + 7 - x] = idx;
+        }
+    }
+    this->m_dirty[tile] = false;
+}
+} // namespace gbc
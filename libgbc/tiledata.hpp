@@ -1,5 +1,6 @@
 #pragma once
 #include "memory.hpp"
+#include "tilecache.hpp"
 
 namespace gbc
 {
@@ -15,19 +16,29 @@ public:
     static const int TILE_W = 8;
     static const int TILE_H = 8;
 
-    TileData(const uint8_t* tile, const uint8_t* pattern, const uint8_t* attr, bool sign)
-        : m_tile_base(tile), m_patt_base(pattern), m_attr_base(attr), m_signed(sign)
+    // patt_tile is the first tile of the pattern table, 0 or 128
+    TileData(TileCache& cache, const uint8_t* vram, const uint8_t* tile, int patt_tile,
+             const uint8_t* attr, bool sign)
+        : m_cache(cache)
+        , m_vram(vram)
+        , m_tile_base(tile)
+        , m_patt_tile(patt_tile)
+        , m_attr_base(attr)
+        , m_signed(sign)
     {}
 
     int tile_attr(int tx, int ty);
     int tile_id(int tx, int ty);
     int pattern(int t, int tattr, int dx, int dy) const;
-    int pattern(const uint8_t* base, int tattr, int t, int dx, int dy) const;
+    // the 8 pixels of row dy in the tile, from left to right
+    const uint8_t* row(int t, int tattr, int dy) const;
     void set_tilebase(const uint8_t* new_base) { m_tile_base = new_base; }
 
 private:
+    TileCache& m_cache;
+    const uint8_t* m_vram;
     const uint8_t* m_tile_base;
-    const uint8_t* m_patt_base;
+    const int m_patt_tile;
     const uint8_t* m_attr_base;
     const bool m_signed;
 };
@@ -43,23 +54,15 @@ inline int TileData::tile_attr(int x, int y)
     return m_attr_base[y * 32 + x];
 }
 
-inline int TileData::pattern(const uint8_t* base, int tid, int tattr, int tx, int ty) const
+inline const uint8_t* TileData::row(int tid, int tattr, int ty) const
 {
-    if (tattr & 0x20) tx = 7 - tx;
     if (tattr & 0x40) ty = 7 - ty;
-    if (tattr & 0x08) base += 0x2000;
-    const int offset = 16 * tid + ty * 2;
-    // get 16-bit c0, c1
-    uint8_t c0 = base[offset];
-    uint8_t c1 = base[offset + 1];
-    // return combined 4-bits, right to left
-    const int bit = 7 - tx;
-    const int v0 = (c0 >> bit) & 0x1;
-    const int v1 = (c1 >> bit) & 0x1;
-    return v0 | (v1 << 1);
-} // pattern(...)
+    int tile = m_patt_tile + tid;
+    if (tattr & 0x08) tile += TileCache::BANK_TILES;
+    return m_cache.row(m_vram, tile, ty, tattr & 0x20);
+}
 inline int TileData::pattern(int tid, int tattr, int tx, int ty) const
 {
-    return pattern(m_patt_base, tid, tattr, tx, ty);
+    return this->row(tid, tattr, ty)[tx];
 }
 } // namespace gbc
@@ -9,6 +9,8 @@ class CPU;
 struct breakpoint_t
 {
     delegate<void(CPU&, uint8_t)> callback;
+    // optional, only evaluated when the breakpoint is hit
+    delegate<bool(CPU&)> condition = nullptr;
 };
 
 } // namespace gbc
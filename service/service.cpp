@@ -82,24 +82,16 @@ void Service::start()
     machine->set_handler(gbc::Machine::VBLANK, [](gbc::Machine& machine, gbc::interrupt_t&) {
         // std::vector<uint8_t> vec;
         // machine.serialize_state(vec);
-        const int W = machine.gpu.SCREEN_W;
-        const int H = machine.gpu.SCREEN_H;
-
-        for (int y = 0; y < H; y++)
-            for (int x = 0; x < W; x++)
-            {
-                const auto& pixels = machine.gpu.pixels();
-                // Palette mode
-                const uint32_t idx = pixels.at(W * y + x);
-                set_pixel(x + 80, y + 32, idx);
-            }
-        // blit to front framebuffer here
-        gbz80_limited_blit(backbuffer.data());
+        // the GPU has already drawn the palette indices into the backbuffer
+        // blit to front framebuffer here, unless nothing changed
+        if (!machine.gpu.frame_unchanged()) gbz80_limited_blit(backbuffer.data());
         vblanked = true;
         // restore state
         // machine.restore_state(vec);
     });
 
+    // palette mode, at the same place as gbz80_limited_blit()
+    machine->gpu.set_output(&backbuffer[32 * 320 + 80], 320, gbc::INDEX8);
     if (!machine->is_cgb())
     {
         // constant 4-color palette
@@ -4,7 +4,21 @@
 #include <signal.h>
 
 static std::array<uint32_t, 64> palette = {};
+// the screen, as written by the GPU
+static std::array<uint32_t, gbc::GPU::SCREEN_W * gbc::GPU::SCREEN_H> screen = {};
 
+static void save_bitmap(const char* filename, const int size_x, const int size_y,
+                        const uint32_t* colors)
+{
+    // render to BMP
+    std::array<char, BMP_SIZE(256, 256)> array;
+    bmp_init(array.data(), size_x, size_y);
+    for (int y = 0; y < size_y; y++)
+        for (int x = 0; x < size_x; x++) { bmp_set(array.data(), x, y, colors[y * size_x + x]); }
+    // save it!
+    save_file(filename, array);
+    printf("*** Stored screenshot in %s\n", filename);
+}
 static void save_screenshot(const char* filename, const std::vector<uint16_t>& pixels)
 {
     int size_x = 0, size_y = 0;
@@ -25,18 +39,9 @@ static void save_screenshot(const char* filename, const std::vector<uint16_t>& p
     }
     else
         assert(0 && "Unknown size");
-    // render to BMP
-    std::array<char, BMP_SIZE(256, 256)> array;
-    bmp_init(array.data(), size_x, size_y);
-    for (int y = 0; y < size_y; y++)
-        for (int x = 0; x < size_x; x++)
-        {
-            const uint16_t idx = pixels.at(y * size_x + x);
-            bmp_set(array.data(), x, y, palette.at(idx));
-        }
-    // save it!
-    save_file(filename, array);
-    printf("*** Stored screenshot in %s\n", filename);
+    std::vector<uint32_t> colors(pixels.size());
+    for (size_t i = 0; i < pixels.size(); i++) colors[i] = palette.at(pixels[i]);
+    save_bitmap(filename, size_x, size_y, colors.data());
 }
 
 static gbc::Machine* machine = nullptr;
@@ -57,6 +62,11 @@ int main(int argc, char** args)
     printf("Loaded %zu bytes ROM\n", romdata.size());
 
     machine = new gbc::Machine(romdata);
+#ifdef GBC_AOT
+    // optional library of blocks compiled with gbc-aot
+    if (argc >= 3) machine->cpu.blocks().load_precompiled(args[2]);
+#endif
+    machine->gpu.set_output(screen.data(), gbc::GPU::SCREEN_W * 4, gbc::XRGB8888);
     machine->gpu.scanline_rendering(false);
     machine->break_now();
     /*
@@ -84,12 +94,10 @@ int main(int argc, char** args)
     signal(SIGINT, int_handler);
 
     machine->set_handler(gbc::Machine::DEBUG, [](gbc::Machine& machine, gbc::interrupt_t&) {
-        // render a full frame before we can make a screenshot
-        machine.gpu.scanline_rendering(true);
-        machine.simulate_one_frame();
-        machine.gpu.scanline_rendering(false);
+        // draw the last frame from its logged registers, without running another
+        machine.gpu.reconstruct_last_frame();
         static const char* filename = "screenshot.bmp";
-        save_screenshot(filename, machine.gpu.pixels());
+        save_bitmap(filename, gbc::GPU::SCREEN_W, gbc::GPU::SCREEN_H, screen.data());
         // dump background & tiles for this frame
         const char* bgfile = "background.bmp";
         save_screenshot(bgfile, machine.gpu.dump_background());
@@ -0,0 +1,8 @@
+// runs the machine tests in tests.cpp, which exit on success
+extern void do_test_machine();
+
+int main()
+{
+    do_test_machine();
+    return 1;
+}
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <libgbc/machine.hpp>
 using namespace gbc;
 
@@ -5,19 +6,414 @@ inline void execute_n(gbc::Machine& m, int n)
 {
     while (n--) m.cpu.simulate();
 }
+// a 32k ROM with code at the given address, by default a JR -2 loop at the
+// entry point, which the machine has to outlive
+inline std::vector<uint8_t> test_rom(std::initializer_list<uint8_t> code = {0x18, 0xFE},
+                                     const uint16_t addr = 0x100)
+{
+    std::vector<uint8_t> rom(0x8000);
+    std::copy(code.begin(), code.end(), rom.begin() + addr);
+    return rom;
+}
 
 static void test_alu()
 {
-    Machine machine({0x3E, 0xFF, // LD A,  0xFF
-                     0xD6, 0x1,  // SUB A, 0x1
-                     0x0, 0x0},
-                    false);
+    const auto rom = test_rom({0x3E, 0xFF, // LD A,  0xFF
+                               0xD6, 0x1,  // SUB A, 0x1
+                               0x0, 0x0},
+                              0x0);
+    Machine machine(rom, false);
     execute_n(machine, 2);
     assert(machine.cpu.registers().accum == 0xfe);
 }
 
+// the fast renderer has to produce exactly the same pixels as the reference
+static void test_renderer(const bool cgb)
+{
+    std::vector<uint8_t> rom(0x8000);
+    rom[0x143] = cgb ? 0x80 : 0x0;
+    Machine machine(rom, false);
+    uint32_t seed = 1;
+    auto random = [&seed] {
+        seed = seed * 1103515245 + 12345;
+        return uint8_t(seed >> 16);
+    };
+    for (int frame = 0; frame < 64; frame++)
+    {
+        // random tiles, tile maps, attributes, sprites and registers
+        uint8_t* vram = machine.memory.video_ram_ptr();
+        for (int i = 0; i < 0x4000; i++) vram[i] = random();
+        uint8_t* oam = machine.memory.oam_ram_ptr();
+        for (int i = 0; i < 160; i++) oam[i] = random();
+        machine.gpu.reload_video_memory();
+        for (const uint16_t reg : {IO::REG_LCDC, IO::REG_SCY, IO::REG_SCX, IO::REG_WY, IO::REG_WX,
+                                   IO::REG_BGP, IO::REG_OBP0, IO::REG_OBP1})
+        { machine.io.reg(reg) = random(); }
+
+        for (int y = 0; y < GPU::SCREEN_H; y++)
+        {
+            machine.gpu.render_scanline_reference(y);
+            const auto expected = machine.gpu.pixels();
+            machine.gpu.render_scanline(y);
+            assert(machine.gpu.pixels() == expected);
+        }
+    }
+}
+
+// the output buffer has the colors of pixels(), and nothing between lines
+static void test_output(const bool cgb)
+{
+    std::vector<uint8_t> rom(0x8000);
+    rom[0x143] = cgb ? 0x80 : 0x0;
+    Machine machine(rom, false);
+    const int stride = GPU::SCREEN_W + 16;
+    std::vector<uint16_t> buffer(stride * GPU::SCREEN_H, 0xAAAA);
+    machine.gpu.set_output(buffer.data(), stride * 2, RGB565);
+    uint8_t* vram = machine.memory.video_ram_ptr();
+    for (int i = 0; i < 0x4000; i++) vram[i] = i * 7;
+    machine.gpu.reload_video_memory();
+    machine.io.reg(IO::REG_LCDC) = 0x91;
+    machine.io.reg(IO::REG_BGP) = 0xE4;
+    for (int i = 0; i < 128; i++) machine.gpu.setpal(i, i * 13);
+    machine.gpu.render_frame();
+
+    for (int y = 0; y < GPU::SCREEN_H; y++)
+    {
+        for (int x = 0; x < stride; x++)
+        {
+            uint16_t expected = 0xAAAA;
+            if (x < GPU::SCREEN_W)
+            {
+                const uint16_t idx = machine.gpu.pixels().at(y * GPU::SCREEN_W + x);
+                const uint32_t rgb = cgb ? machine.gpu.expand_cgb_color(idx)
+                                         : machine.gpu.expand_dmg_color(idx);
+                expected = ((rgb & 0xF8) << 8) | ((rgb >> 5) & 0x7E0) | ((rgb >> 19) & 0x1F);
+            }
+            assert(buffer.at(y * stride + x) == expected);
+        }
+    }
+}
+
+// skipped frames leave the output buffer alone
+static void test_frameskip()
+{
+    const auto rom = test_rom();
+    Machine machine(rom, false);
+    std::vector<uint8_t> buffer(GPU::SCREEN_W * GPU::SCREEN_H);
+    machine.gpu.set_output(buffer.data(), GPU::SCREEN_W, INDEX8);
+    machine.gpu.set_frameskip(RENDER_NTH, 4);
+    for (int i = 0; i < 12; i++)
+    {
+        std::fill(buffer.begin(), buffer.end(), 0xFF);
+        machine.simulate_one_frame();
+        machine.gpu.wait_for_frame();
+        const bool drawn = machine.gpu.frame_count() % 4 == 0;
+        assert((buffer.front() != 0xFF && buffer.back() != 0xFF) == drawn);
+    }
+    machine.gpu.set_frameskip(RENDER_REQUESTED);
+    machine.gpu.request_frame(machine.gpu.frame_count() + 2);
+    for (int i = 1; i <= 3; i++)
+    {
+        std::fill(buffer.begin(), buffer.end(), 0xFF);
+        machine.simulate_one_frame();
+        machine.gpu.wait_for_frame();
+        assert((buffer.front() != 0xFF) == (i == 2));
+    }
+    // drawn on demand, once
+    machine.gpu.set_frameskip(RENDER_ON_DEMAND);
+    std::fill(buffer.begin(), buffer.end(), 0xFF);
+    machine.simulate_one_frame();
+    machine.gpu.wait_for_frame();
+    assert(buffer.front() == 0xFF);
+    machine.gpu.observe();
+    assert(buffer.front() != 0xFF);
+    std::fill(buffer.begin(), buffer.end(), 0xFF);
+    machine.gpu.observe();
+    assert(buffer.front() == 0xFF);
+}
+
+// only the lines that look different are dirty
+static void test_dirty_lines()
+{
+    const auto rom = test_rom();
+    Machine machine(rom, false);
+    std::vector<uint32_t> buffer(GPU::SCREEN_W * GPU::SCREEN_H);
+    machine.gpu.set_output(buffer.data(), GPU::SCREEN_W * 4, XRGB8888);
+    uint8_t* vram = machine.memory.video_ram_ptr();
+    std::fill_n(vram, 0x2000, 0x0);
+    std::fill_n(&vram[0x10], 16, 0xFF);
+    machine.gpu.reload_video_memory();
+    machine.io.reg(IO::REG_LCDC) = 0x91;
+    machine.io.reg(IO::REG_BGP) = 0xE4;
+    machine.gpu.render_frame();
+    machine.gpu.render_frame();
+    assert(machine.gpu.frame_unchanged());
+
+    vram[0x1800 + 3 * 32] = 1;
+    machine.gpu.reload_video_memory();
+    machine.gpu.render_frame();
+    for (int y = 0; y < GPU::SCREEN_H; y++)
+    { assert(machine.gpu.dirty_lines().test(y) == (y >= 24 && y < 32)); }
+    // the same palette indices in new colors
+    machine.gpu.set_dmg_variant(GRAYSCALE);
+    machine.gpu.render_frame();
+    assert(machine.gpu.dirty_lines().all());
+}
+
+// a frame drawn from the register log looks like one drawn scanline by
+// scanline, raster effects included
+static void test_reconstruct()
+{
+    const auto rom = test_rom();
+    Machine rendered(rom, false);
+    Machine logged(rom, false);
+    logged.gpu.scanline_rendering(false);
+    for (auto* machine : {&rendered, &logged})
+    {
+        uint8_t* vram = machine->memory.video_ram_ptr();
+        for (int i = 0; i < 0x2000; i++) vram[i] = i * 7;
+        machine->gpu.reload_video_memory();
+        machine->io.reg(IO::REG_BGP) = 0xE4;
+        machine->simulate_one_frame();
+        while (machine->gpu.current_scanline() != 72) machine->cpu.simulate();
+        machine->io.reg(IO::REG_SCX) = 3;
+        while (machine->gpu.current_scanline() != 144) machine->cpu.simulate();
+    }
+    assert(rendered.gpu.frame_count() == logged.gpu.frame_count());
+    assert(logged.gpu.pixels() != rendered.gpu.pixels());
+    assert(logged.gpu.reconstruct_last_frame() == rendered.gpu.pixels());
+    // the frame after it is different, with SCX still 3 at the top
+    rendered.simulate_one_frame();
+    assert(logged.gpu.reconstruct_last_frame() != rendered.gpu.pixels());
+}
+
+// DIV and TIMA only count when they have to, but always read back exactly
+static void test_timer()
+{
+    const auto rom = test_rom();
+    Machine machine(rom, false);
+    machine.memory.write8(IO::REG_TAC, 0x05); // every 16 cycles
+    machine.memory.write8(IO::REG_TIMA, 0x00);
+    machine.memory.write8(IO::REG_TMA, 0x80);
+    machine.memory.write8(IO::REG_DIV, 0x00);
+    const uint64_t start = machine.cpu.gettime();
+    while (machine.cpu.gettime() < start + 16 * 200) machine.cpu.simulate();
+    const uint64_t elapsed = machine.cpu.gettime() - start;
+    assert(machine.memory.read8(IO::REG_TIMA) == elapsed / 16);
+    assert(machine.memory.read8(IO::REG_DIV) == elapsed / 256);
+    assert((machine.io.reg(IO::REG_IF) & machine.io.timerint.mask) == 0);
+    // overflowing raises the interrupt, and reloads from TMA
+    while (machine.cpu.gettime() < start + 16 * 300) machine.cpu.simulate();
+    assert(machine.io.reg(IO::REG_IF) & machine.io.timerint.mask);
+    assert(machine.memory.read8(IO::REG_TIMA) >= 0x80);
+}
+
+// save states have the same format with and without lazy flags: evaluated
+// flags, and no room for anything but the architectural registers
+static void test_save_state()
+{
+    const auto rom = test_rom({0x3E, 0xFF,  // LD A, 0xFF
+                               0xC6, 0x01,  // ADD A, 0x1
+                               0x18, 0xFE}, // JR -2
+                              0x0);
+    Machine machine(rom, false);
+    execute_n(machine, 3);
+    std::vector<uint8_t> state;
+    machine.serialize_state(state);
+    assert(state.at(0) == (MASK_ZERO | MASK_HALFCARRY | MASK_CARRY));
+    assert(state.at(1) == 0x00);
+    uint64_t cycles;
+    std::memcpy(&cycles, &state.at(16), sizeof(cycles));
+    assert(cycles == machine.cpu.gettime());
+
+    Machine restored(rom, false);
+    restored.restore_state(state);
+    std::vector<uint8_t> again;
+    restored.serialize_state(again);
+    assert(again == state);
+}
+
+// a halted CPU with nothing scheduled still moves along a frame at a time
+static void test_halt_lcd_off()
+{
+    const auto rom = test_rom({0xAF,       // XOR A
+                               0xE0, 0x40, // LDH (LCDC), A
+                               0xE0, 0x07, // LDH (TAC), A
+                               0xE0, 0xFF, // LDH (IE), A
+                               0x76},      // HALT
+                              0x0);
+    Machine machine(rom, false);
+    while (!machine.cpu.is_halting()) machine.cpu.simulate();
+    for (int i = 0; i < 10; i++)
+    {
+        const uint64_t start = machine.cpu.gettime();
+        machine.cpu.simulate();
+        const uint64_t elapsed = machine.cpu.gettime() - start;
+        assert(elapsed > 0 && elapsed <= 70224);
+        assert(machine.cpu.is_halting());
+    }
+}
+
+// the cycles a single simulate() takes, once the loop at addr is running
+static uint64_t loop_iteration(Machine& machine, const uint16_t addr)
+{
+    while (machine.cpu.registers().pc != addr) machine.cpu.simulate();
+    execute_n(machine, 4);
+    const uint64_t start = machine.cpu.gettime();
+    machine.cpu.simulate();
+    return machine.cpu.gettime() - start;
+}
+
+// polling a flag in Work RAM can be skipped up to the next event, but
+// polling DIV can't, even when a register points elsewhere after the read
+static void test_idle_loops()
+{
+#ifdef GBC_THREADED_CORE
+    return; // runs a scanline at a time, and never skips
+#endif
+    const auto wram = test_rom({0xAF,             // XOR A
+                                0xE0, 0x40,       // LDH (LCDC), A
+                                0xE0, 0x07,       // LDH (TAC), A
+                                0x21, 0x00, 0xC0, // LD HL, 0xC000
+                                0x7E,             // LD A, (HL)
+                                0xA7,             // AND A
+                                0x28, 0xFC},      // JR Z, -4
+                               0x0);
+    Machine flag(wram, false);
+    flag.memory.write8(0xC000, 0x00);
+    assert(loop_iteration(flag, 0x8) > 24);
+    flag.cpu.idle_skipping(false);
+    assert(loop_iteration(flag, 0x8) == 24);
+
+    const auto div = test_rom({0xAF,       // XOR A
+                               0xE0, 0x40, // LDH (LCDC), A
+                               0xE0, 0x07, // LDH (TAC), A
+                               0x26, 0xFF, // LD H, 0xFF
+                               0x2E, 0x04, // LD L, 0x04
+                               0x7E,       // LD A, (HL)
+                               0x2E, 0x80, // LD L, 0x80
+                               0x18, 0xF9}, // JR -7
+                              0x0);
+    Machine timer(div, false);
+    assert(loop_iteration(timer, 0x7) == 36);
+}
+
+// random ALU, rotate and branch code in a loop, which waits for V-blank in
+// an idle loop at the end, with a V-blank handler counting frames in WRAM
+static std::vector<uint8_t> random_code_rom()
+{
+    std::vector<uint8_t> rom(0x8000);
+    uint32_t seed = 1;
+    auto random = [&seed] {
+        seed = seed * 1103515245 + 12345;
+        return uint8_t(seed >> 16);
+    };
+    const uint8_t handler[] = {0xE5,             // PUSH HL
+                               0x21, 0xFF, 0xC1, // LD HL, 0xC1FF
+                               0x34,             // INC (HL)
+                               0xE1,             // POP HL
+                               0xD9};            // RETI
+    std::copy(std::begin(handler), std::end(handler), rom.begin() + 0x40);
+    const uint8_t init[] = {0x31, 0xF0, 0xDF, // LD SP, 0xDFF0
+                            0x3E, 0x91,       // LD A, 0x91
+                            0xE0, 0x40,       // LDH (LCDC), A
+                            0x3E, 0x01,       // LD A, 0x1
+                            0xE0, 0xFF,       // LDH (IE), A
+                            0xFB};            // EI
+    // jump over the cartridge header
+    rom[0x100] = 0xC3; // JP 0x150
+    rom[0x101] = 0x50;
+    rom[0x102] = 0x01;
+    std::copy(std::begin(init), std::end(init), rom.begin() + 0x150);
+    const uint16_t loop = 0x150 + sizeof(init);
+
+    std::vector<uint8_t> code;
+    // an instruction that reads anything, but only writes A to WRAM at HL
+    auto instruction = [&] {
+        static const uint8_t regs[] = {0, 1, 2, 3, 7}; // B, C, D, E, A
+        const uint8_t dst = regs[random() % 5];
+        switch (random() % 8)
+        {
+        case 0: // LD D, imm8
+            code.insert(code.end(), {uint8_t(0x06 | dst << 3), random()});
+            break;
+        case 1: // LD D, S / (HL)
+            code.push_back(0x40 | dst << 3 | (random() % 8));
+            break;
+        case 2: // ALU A, S / (HL)
+            code.push_back(0x80 | (random() % 0x40));
+            break;
+        case 3: // ALU A, imm8
+            code.insert(code.end(), {uint8_t(0xC6 | (random() % 8) << 3), random()});
+            break;
+        case 4: // INC / DEC D
+            code.push_back(0x04 | dst << 3 | (random() % 2));
+            break;
+        case 5: // RLCA, RRCA, RLA, RRA, DAA, CPL, SCF, CCF
+            code.push_back(0x07 | (random() % 8) << 3);
+            break;
+        case 6: // CB-prefixed on D, or BIT on (HL)
+            code.insert(code.end(), {0xCB, uint8_t((random() % 2) ? (random() & 0xF8) | dst
+                                                                   : 0x46 | (random() % 8) << 3)});
+            break;
+        default: // LD (HL), A
+            code.push_back(0x77);
+            break;
+        }
+    };
+    code.insert(code.end(), {0x21, 0x00, 0xC0}); // LD HL, 0xC000
+    for (int i = 0; i < 64; i++)
+    {
+        // a conditional jump over a few instructions
+        code.insert(code.end(), {uint8_t(0x20 | (random() % 4) << 3), 0x0});
+        const size_t jump = code.size();
+        for (int j = random() % 4; j >= 0; j--) instruction();
+        code[jump - 1] = code.size() - jump;
+    }
+    const uint8_t wait[] = {0x21, 0xFF, 0xC1, // LD HL, 0xC1FF
+                            0x7E,             // LD A, (HL)
+                            0xBE,             // CP (HL)
+                            0x28, 0xFD,       // JR Z, -3
+                            0xC3, uint8_t(loop), uint8_t(loop >> 8)}; // JP loop
+    code.insert(code.end(), std::begin(wait), std::end(wait));
+    std::copy(code.begin(), code.end(), rom.begin() + loop);
+    return rom;
+}
+
+// the decode cache, idle loop skipping and the JIT leave the machine in
+// exactly the same state as the interpreter, frame after frame
+static void test_bit_exact()
+{
+    const auto rom = random_code_rom();
+    Machine interpreted(rom);
+    interpreted.cpu.decode_cache(false);
+    Machine cached(rom);
+    for (int frame = 0; frame < 60; frame++)
+    {
+        interpreted.simulate_one_frame();
+        cached.simulate_one_frame();
+        std::vector<uint8_t> expected, state;
+        interpreted.serialize_state(expected);
+        cached.serialize_state(state);
+        assert(state == expected);
+    }
+    assert(interpreted.memory.read8(0xC1FF) >= 59);
+}
+
 void do_test_machine()
 {
+    test_renderer(false);
+    test_renderer(true);
+    test_output(false);
+    test_output(true);
+    test_frameskip();
+    test_dirty_lines();
+    test_reconstruct();
+    test_timer();
+    test_save_state();
+    test_halt_lcd_off();
+    test_idle_loops();
+    test_bit_exact();
     test_alu();
 
     printf("Tests SUCCESS!\n");
@@ -208,11 +208,19 @@ static void write_recorded_state(const buffer_t& inputs)
 
 #include <future>
 #include <thread>
+#ifdef GBC_AOT
+// optional library of blocks compiled with gbc-aot
+static const char* precompiled = nullptr;
+#endif
+
 static training_results_t training_session(const int tidx, const buffer_t& romdata,
                                            const buffer_t machine_state)
 {
     gbc::Machine machine{romdata};
     machine.gpu.scanline_rendering(false);
+#ifdef GBC_AOT
+    if (precompiled != nullptr) machine.cpu.blocks().load_precompiled(precompiled);
+#endif
     if (!machine_state.empty()) { machine.restore_state(machine_state); }
 
     Worker thread_ctx{.tidx = tidx};
@@ -227,6 +235,9 @@ int main(int argc, char** args)
 {
     const char* romfile = "../smbland2_dx.gbc";
     if (argc >= 2) romfile = args[1];
+#ifdef GBC_AOT
+    if (argc >= 3) precompiled = args[2];
+#endif
 
     const auto romdata = load_file(romfile);
     printf("Loaded %zu bytes ROM\n", romdata.size());
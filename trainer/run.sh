@@ -5,4 +5,4 @@ pushd build
 cmake ..
 make -j3
 popd
-./build/trainer $1
+./build/trainer "$@"